@@ -38,7 +38,7 @@ static void set_page_addr(lcd_t *lcd, uint8_t *buf) {
 static void set_disp_start_line(lcd_t *lcd, uint8_t *buf) {
     uint8_t new_start = buf[1];
     if (new_start != lcd->display_start_line) {
-        *(lcd->should_redraw) = 1;
+        lcd_invalidate(lcd);
     }
     lcd->display_start_line = new_start;
 }
@@ -142,7 +142,7 @@ static uint8_t LCD_CMD_MAP[] = {
 /* F */ 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35,
 };
 
-void lcd_init(lcd_t *lcd, int *should_redraw) {
+void lcd_init(lcd_t *lcd) {
     memset(lcd, 0, sizeof(lcd_t));
 
     lcd->mux_ratio             = 0xA0;
@@ -151,7 +151,13 @@ void lcd_init(lcd_t *lcd, int *should_redraw) {
     lcd->lower_window_corner_y = 159;
 
     lcd->buf_off = 0;
-    lcd->should_redraw = should_redraw;
+    // draw the first frame
+    lcd_invalidate(lcd);
+}
+
+void lcd_invalidate(lcd_t *lcd) {
+    lcd->dirty_pages = LCD_ALL_PAGES;
+    lcd->version++;
 }
 
 void lcd_cmd(lcd_t *lcd, uint8_t byte) {
@@ -179,6 +185,12 @@ void lcd_cmd(lcd_t *lcd, uint8_t byte) {
 }
 
 void lcd_data(lcd_t *lcd, uint8_t byte) {
-    lcd->ram[lcd->page_address][lcd->column_address++] = byte;
+    uint8_t *cell = &lcd->ram[lcd->page_address][lcd->column_address++];
     lcd->column_address &= 0xFF;
+    // the ROM redraws whole screens that mostly didn't change
+    if (*cell != byte) {
+        *cell = byte;
+        lcd->dirty_pages |= 1u << lcd->page_address;
+        lcd->version++;
+    }
 }
\ No newline at end of file
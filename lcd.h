@@ -1,10 +1,12 @@
 #pragma once
 #include <stdint.h>
 
-#define LCD_PAGE_SIZE 0xFF
+// the column address is 8 bits wide, so every page holds 256 bytes
+#define LCD_PAGE_SIZE 0x100
 #define LCD_NUM_COLS  0x7F
 #define LCD_NUM_PAGES 21
 #define LCD_RAM_SIZE (LCD_PAGE_SIZE * LCD_NUM_PAGES)
+#define LCD_ALL_PAGES ((1u << LCD_NUM_PAGES) - 1)
 
 typedef struct lcd {
     uint8_t page_address;
@@ -23,14 +25,20 @@ typedef struct lcd {
 
     uint8_t buf[2];
     uint8_t buf_off;
-    uint8_t ram[LCD_NUM_PAGES][LCD_RAM_SIZE];
-    int *should_redraw;
+    uint8_t ram[LCD_NUM_PAGES][LCD_PAGE_SIZE];
+    // pages whose content changed since the frontend last looked, all of
+    // them when the whole screen needs redrawing
+    uint32_t dirty_pages;
+    // bumped on every change to what is displayed
+    uint32_t version;
 } lcd_t;
 
-void lcd_init(lcd_t *lcd, int *redraw);
+void lcd_init(lcd_t *lcd);
 
 void lcd_cmd(lcd_t *lcd, uint8_t byte);
 
 void lcd_data(lcd_t *lcd, uint8_t byte);
 
-void lcd_stop(lcd_t *lcd);
\ No newline at end of file
+void lcd_stop(lcd_t *lcd);
+
+void lcd_invalidate(lcd_t *lcd);
\ No newline at end of file
@@ -2,10 +2,13 @@
 #include <stdint.h>
 
 #include "ssu.h"
+#include "eeprom.h"
 #include "lcd.h"
 #include "accel.h"
 #include "rtc.h"
 #include "portb.h"
+#include "sched.h"
+#include "powar.h"
 
 #define ROM_end   0xBFFF
 #define IO1_start 0xF020
@@ -14,6 +17,14 @@
 #define RAM_end   0xFF80
 #define IO2_start 0xFF80
 #define IO2_end   0xFFFF
+#define IO1_SIZE  (IO1_end - IO1_start)
+#define IO2_SIZE  (IO2_end - IO2_start + 1)
+
+// RAM and I/O boundaries are all 128 byte aligned
+#define PAGE_SHIFT 7
+#define PAGE_SIZE  (1 << PAGE_SHIFT)
+#define PAGE_MASK  (PAGE_SIZE - 1)
+#define NUM_PAGES  (0x10000 >> PAGE_SHIFT)
 
 typedef enum {
     MODE_ACTIVE_HIGH,
@@ -26,17 +37,94 @@ typedef enum {
     MODE_WATCH,
 } exec_mode_t;
 
-
+// Operation whose condition codes haven't been written to the CCR yet
+enum flags_op {
+    FLAGS_NONE,
+    FLAGS_MOV8, FLAGS_MOV16, FLAGS_MOV32,
+    FLAGS_SUB8, FLAGS_SUB16, FLAGS_SUB32,
+    FLAGS_SHL8, FLAGS_SHL16, FLAGS_SHL32,
+    FLAGS_SHR8, FLAGS_SHR16, FLAGS_SHR32,
+    FLAGS_ROTL8, FLAGS_ROTL16,
+    FLAGS_DEC8, FLAGS_DEC16,
+};
+
+// Device the SSU is currently talking to
+enum ssu_target {
+    SSU_NONE,
+    SSU_EEPROM,
+    SSU_LCD_DATA,
+    SSU_LCD_CMD,
+    SSU_ACCEL,
+};
+
+struct pw_context;
+
+// Decode cache entry: the instruction taken apart once, so its handler
+// only reads the fields. rs and rd are register numbers, or a bit number
+// or branch condition in rs; imm is an immediate, an address, a
+// displacement or a branch target. ROM entries are built once per ROM
+// image and shared by every instance running it.
+typedef struct pw_decoded {
+    void (*handler)(struct pw_context *ctx, const struct pw_decoded *d);
+    uint16_t instr;
+    // handler index for the threaded interpreter
+    uint8_t op;
+    // length in bytes and the operand words fetched after the opcode
+    uint8_t len;
+    uint8_t fetches;
+    uint8_t rs;
+    uint8_t rd;
+    uint32_t imm;
+} pw_decoded_t;
+
+#define DECODE_CACHE_SIZE ((ROM_end + 1) / 2)
+
+#define INPUT_QUEUE_SIZE 64
+
+typedef struct pw_input_event {
+    uint64_t at;
+    uint32_t type;
+    uint32_t value;
+} pw_input_event_t;
 
 typedef struct pw_context {
-    uint8_t rom[1 << 16];
+    // shared with other instances, never written
+    const uint8_t *rom;
+    const pw_decoded_t *decode_cache;
+    struct pw_rom *own_rom;
+    uint32_t rom_hash;
+    // RTC start time applied at reset
+    int clock_emulated;
+    int64_t clock_base;
+    // inputs queued by another thread, a single-producer single-consumer
+    // ring indexed by free running counters
+    pw_input_event_t input_queue[INPUT_QUEUE_SIZE];
+    uint32_t input_head;
+    uint32_t input_tail;
+    // embedder's frame callback and the frame it last saw
+    pw_frame_callback_t frame_cb;
+    void *frame_cb_user;
+    uint32_t frame_cb_version;
+    uint32_t frame_cb_hash;
     uint8_t eeprom_data[1 << 16];
     uint8_t ram[RAM_end - RAM_start];
+    const uint8_t *read_pages[NUM_PAGES];
+    uint8_t *write_pages[NUM_PAGES];
     uint16_t regs[16];
     uint8_t ccr;
+    enum flags_op flags_op;
+    uint32_t flags_a;
+    uint32_t flags_b;
+    uint32_t flags_res;
     uint16_t ip;
     uint16_t instr_prefetch;
 
+    // decode cache entry of the current instruction
+    const pw_decoded_t *cur;
+    pw_decoded_t decode_scratch;
+    // translated ROM code, NULL when the interpreter runs everything
+    struct pw_jit *jit;
+
     uint8_t pdr1;
     uint8_t pdr9;
 
@@ -73,7 +161,10 @@ typedef struct pw_context {
     uint16_t grc;
     uint16_t grd;
 
+    // TCNT and the prescaler remainder are only brought up to date when
+    // something looks at them; tmrw_synced is when that last happened
     uint8_t tmrw_rem;
+    uint64_t tmrw_synced;
 
     uint8_t rdr;
     uint8_t tdr;
@@ -85,6 +176,7 @@ typedef struct pw_context {
     uint8_t semr;
 
     ssu_t ssu;
+    enum ssu_target ssu_target;
     eeprom_t eeprom;
     lcd_t lcd;
     accel_t accel;
@@ -93,6 +185,7 @@ typedef struct pw_context {
 
     uint16_t prev_ip;
     uint8_t keys_pressed;
+    int halted;
     exec_mode_t mode;
     int int_enabled;
     int internal_states;
@@ -101,5 +194,13 @@ typedef struct pw_context {
 
     int states;
 
+    // states executed before the current batch
+    uint64_t cycles;
+    sched_t sched;
+    // ctx->states value at which the run loop has to stop next, either for
+    // the end of the batch or for the earliest scheduled event
+    int deadline;
+    int run_until;
+
     int i,j,k,l,m,n;
 } pw_context_t;
\ No newline at end of file
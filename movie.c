@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "powar.h"
+
+// Input movies. A movie starts at reset with the RTC on the emulated clock,
+// so the only thing that can make two runs differ is input, and every input
+// change is logged with the cycle it was applied at. Replaying runs exactly
+// to each of those cycles and applies the same input there.
+//
+// File layout, little endian:
+//   header: "PWMV", version (u32), ROM + EEPROM hash (u32), clock base (i64)
+//   events: cycles since the previous event (varint), type (u8), payload
+// The last event is MOVIE_END, at the cycle recording stopped.
+
+#define MOVIE_MAGIC   "PWMV"
+#define MOVIE_VERSION 1
+#define HEADER_SIZE   20
+
+enum movie_event {
+    MOVIE_END  = 0,
+    MOVIE_KEYS = 1, // u8 key mask
+};
+
+struct pw_movie {
+    pw_context_t *ctx;
+    FILE *f;
+    int recording;
+    uint64_t last;  // cycle of the previous event
+
+    // replay only, the next event to apply
+    uint64_t next_at;
+    int next_type;
+    uint8_t next_keys;
+    int done;
+    int desync;
+};
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        fputc((v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    fputc(v, f);
+}
+
+static int read_varint(FILE *f, uint64_t *v) {
+    int c, shift = 0;
+    *v = 0;
+    do {
+        if ((c = fgetc(f)) == EOF || shift > 63) {
+            return 0;
+        }
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 1;
+}
+
+static void write_event(pw_movie_t *m, uint64_t at, int type) {
+    write_varint(m->f, at - m->last);
+    fputc(type, m->f);
+    m->last = at;
+}
+
+// Reads the next event, a truncated movie ends where the data does
+static void read_event(pw_movie_t *m) {
+    uint64_t delta;
+    int type, keys = 0;
+
+    if (!read_varint(m->f, &delta) || (type = fgetc(m->f)) == EOF ||
+        (type == MOVIE_KEYS && (keys = fgetc(m->f)) == EOF)) {
+        m->next_type = MOVIE_END;
+        m->next_at = m->last;
+        return;
+    }
+    m->next_at = m->last + delta;
+    m->next_type = type;
+    m->next_keys = keys;
+}
+
+pw_movie_t *pw_movie_record(const char *path, pw_context_t *ctx, int64_t clock_base) {
+    uint8_t header[HEADER_SIZE];
+    pw_movie_t *m = calloc(1, sizeof(pw_movie_t));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->f = fopen(path, "wb");
+    if (m->f == NULL) {
+        fprintf(stderr, "Could not write %s\n", path);
+        free(m);
+        return NULL;
+    }
+    m->ctx = ctx;
+    m->recording = 1;
+
+    pw_set_clock(ctx, clock_base);
+    pw_reset(ctx);
+
+    memcpy(header, MOVIE_MAGIC, 4);
+    put_u32(header + 4, MOVIE_VERSION);
+    put_u32(header + 8, pw_image_hash(ctx));
+    put_u32(header + 12, (uint32_t)clock_base);
+    put_u32(header + 16, (uint32_t)((uint64_t)clock_base >> 32));
+    fwrite(header, 1, sizeof(header), m->f);
+    return m;
+}
+
+void pw_movie_set_keys(pw_movie_t *m, uint8_t keys) {
+    if (m->recording) {
+        write_event(m, pw_get_cycles(m->ctx), MOVIE_KEYS);
+        fputc(keys, m->f);
+    }
+    pw_set_keys(m->ctx, keys);
+}
+
+pw_movie_t *pw_movie_play(const char *path, pw_context_t *ctx) {
+    uint8_t header[HEADER_SIZE];
+    pw_movie_t *m = calloc(1, sizeof(pw_movie_t));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->f = fopen(path, "rb");
+    if (m->f == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        free(m);
+        return NULL;
+    }
+    m->ctx = ctx;
+    if (fread(header, 1, sizeof(header), m->f) != sizeof(header) ||
+        memcmp(header, MOVIE_MAGIC, 4) != 0 || get_u32(header + 4) != MOVIE_VERSION) {
+        fprintf(stderr, "%s is not a movie this version can play\n", path);
+        pw_movie_close(m);
+        return NULL;
+    }
+    if (get_u32(header + 8) != pw_image_hash(ctx)) {
+        fprintf(stderr, "%s was recorded with a different ROM or EEPROM\n", path);
+        pw_movie_close(m);
+        return NULL;
+    }
+
+    pw_set_clock(ctx, (int64_t)(get_u32(header + 12) | ((uint64_t)get_u32(header + 16) << 32)));
+    pw_reset(ctx);
+    read_event(m);
+    return m;
+}
+
+long pw_movie_run(pw_movie_t *m, int states) {
+    pw_context_t *ctx = m->ctx;
+    uint64_t now = pw_get_cycles(ctx);
+    uint64_t end = now + states;
+    long count = 0;
+
+    if (m->recording) {
+        return pw_run_states(ctx, states);
+    }
+    while (!m->done && !pw_halted(ctx)) {
+        if (now >= m->next_at) {
+            if (now != m->next_at) {
+                // the run overshot the event, from here on it's a different run
+                m->desync = 1;
+            }
+            if (m->next_type != MOVIE_KEYS) {
+                m->done = 1;
+                break;
+            }
+            pw_set_keys(ctx, m->next_keys);
+            m->last = m->next_at;
+            read_event(m);
+            continue;
+        }
+        if (now >= end) {
+            break;
+        }
+        uint64_t until = m->next_at < end ? m->next_at : end;
+        count += pw_run_states(ctx, (int)(until - now));
+        now = pw_get_cycles(ctx);
+    }
+    return count;
+}
+
+int pw_movie_done(pw_movie_t *m) {
+    return m->done;
+}
+
+int pw_movie_desynced(pw_movie_t *m) {
+    return m->desync;
+}
+
+int pw_movie_close(pw_movie_t *m) {
+    if (m == NULL) {
+        return 1;
+    }
+    if (m->recording) {
+        write_event(m, pw_get_cycles(m->ctx), MOVIE_END);
+    }
+    int ok = fclose(m->f) == 0;
+    free(m);
+    return ok;
+}
@@ -0,0 +1,5439 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <stdarg.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "powar.h"
+#include "ssu.h"
+#include "eeprom.h"
+#include "lcd.h"
+#include "accel.h"
+#include "rtc.h"
+#include "sched.h"
+#include "interrupts.h"
+#include "main.h"
+
+// TODO: internal states for:
+// MOV.W Rs,@–ERd
+// POP.W Rn
+
+#define STATES(si, sj, sk, sl, sm, sn) ctx->i = si; ctx->j = sj; ctx->k = sk; ctx->l = sl; ctx->m = sm; ctx->n = sn;
+
+#ifdef PKW_DEBUG
+__attribute__ ((unused)) static void debug_internal(const char *format, ...) {
+    if (1) {
+        va_list args;
+        va_start(args, format);
+        vfprintf(stdout, format, args);
+
+        va_end(args);
+        fflush(stdout);
+    }
+}
+#endif
+
+//#define PKW_DEBUG
+#ifdef PKW_DEBUG
+#define debug(...) debug_internal(__VA_ARGS__)
+#else
+#define debug(...)
+#endif
+
+#define UNIMPL(...)
+//debug_internal(__VA_ARGS__)
+
+#ifdef _MSC_VER
+#define likely(x)       (x)
+#define unlikely(x)     (x)
+#else
+#define likely(x)       __builtin_expect((x),1)
+#define unlikely(x)     __builtin_expect((x),0)
+#endif
+
+// Ordered accesses for data shared between threads: the input queue and
+// the I/O register table.
+// MSVC only orders volatile accesses on x86 and x64 and not at all with
+// /volatile:iso, so it gets interlocked operations, which are full barriers.
+#ifdef _MSC_VER
+#define load_acquire(p)     ((uint32_t)_InterlockedOr((volatile long*)(p), 0))
+#define store_release(p, v) ((void)_InterlockedExchange((volatile long*)(p), (long)(v)))
+#define cas32(p, old, new)  (_InterlockedCompareExchange((volatile long*)(p), (long)(new), (long)(old)) == (long)(old))
+#else
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define cas32(p, old, new)  __sync_bool_compare_and_swap((p), (old), (new))
+#endif
+
+// Threaded interpreter: runs a whole batch inside one function and
+// dispatches through a table of label addresses, so there is no call,
+// return or debug bookkeeping per instruction. Debug builds keep using
+// pw_step so print_state/verifyStates still see every instruction.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(PKW_DEBUG) && !defined(PW_NO_THREADED)
+#define PW_THREADED
+#endif
+
+// Translation of ROM code to x86-64 for the threaded loop, see pw_set_jit.
+// Build with PW_NO_JIT to leave it out.
+#if defined(PW_THREADED) && defined(__x86_64__) && !defined(_WIN32) && !defined(PW_NO_JIT)
+#define PW_JIT
+#endif
+
+enum REGISTER_TYPE {
+    REGTYPE_DBW8_ACCS2,
+    REGTYPE_DBW8_ACCS3,
+    REGTYPE_DBW16_ACCS2
+};
+
+typedef struct mm_reg {
+    char *name;
+    char *desc;
+    uint16_t addr;
+    enum REGISTER_TYPE type;
+    union {
+        uint8_t  (*read8)(uintptr_t);
+        uint16_t (*read16)(uintptr_t);
+    };
+    union {
+        void (*write8)(uintptr_t, uint8_t);
+        void (*write16)(uintptr_t, uint16_t);
+    };
+    int ctx_offset;
+} mm_reg_t;
+
+#define MM_REG8( _name, _addr, _type, _read, _write, _desc, _ctx_off) { .name = _name, .desc = _desc, .addr = _addr, .type = _type, .read8 = (uint8_t (*)(uintptr_t)) _read, .write8 = (void (*)(uintptr_t, uint8_t)) _write, .ctx_offset = _ctx_off}
+#define MM_REG16(_name, _addr, _type, _read, _write, _desc, _ctx_off) { .name = _name, .desc = _desc, .addr = _addr, .type = _type, .read16 = (uint16_t (*)(uintptr_t)) _read, .write16 = (void (*)(uintptr_t, uint16_t)) _write, .ctx_offset = _ctx_off}
+
+//MM_REG("UNK_REG",   0xF088, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Unknown IO Reg (TODO?)", 0),
+
+static uint8_t io2_get_pdr1(pw_context_t *ctx);
+static void io2_set_pdr1(pw_context_t *ctx, uint8_t val);
+static uint8_t io2_get_pdr9(pw_context_t *ctx);
+static void io2_set_pdr9(pw_context_t *ctx, uint8_t val);
+
+static uint8_t sci_get_rdr(pw_context_t *ctx) {
+    return 0xFC ^ 0xAA;// ctx->rdr;
+}
+
+static void sci_set_tdr(pw_context_t *ctx, uint8_t val) {
+    ctx->tdr = val;
+}
+
+static uint8_t sci_get_tdr(pw_context_t *ctx) {
+    return ctx->tdr;
+}
+
+#define SCI_SMR_COM_BIT 7
+
+static void sci_set_smr(pw_context_t *ctx, uint8_t val) {
+    ctx->smr = val;
+    printf("[SCI SMR] COM:%d\n", 
+        !!(ctx->smr & (1 << SCI_SMR_COM_BIT))
+    );
+}
+
+static uint8_t sci_get_smr(pw_context_t *ctx) {
+    return ctx->smr;
+}
+
+#define SCI_SCR_TIE_BIT 7
+#define SCI_SCR_RIE_BIT 6
+#define SCI_SCR_TE_BIT 5
+#define SCI_SCR_RE_BIT 4
+#define SCI_SCR_MPIE_BIT 3
+#define SCI_SCR_TEIE_BIT 2
+#define SCI_SCR_CKE_MASK 3
+
+static void sci_set_scr(pw_context_t *ctx, uint8_t val) {
+    ctx->scr = val;
+    printf("[SCI SCR] TIE:%d RIE:%d TE:%d RE:%d MPIE:%d TEIE:%d CKE:%d\n", 
+        !!(ctx->scr & (1 << SCI_SCR_TIE_BIT)),
+        !!(ctx->scr & (1 << SCI_SCR_RIE_BIT)),
+        !!(ctx->scr & (1 << SCI_SCR_TE_BIT)),
+        !!(ctx->scr & (1 << SCI_SCR_RE_BIT)),
+        !!(ctx->scr & (1 << SCI_SCR_MPIE_BIT)),
+        !!(ctx->scr & (1 << SCI_SCR_TEIE_BIT)),
+        (ctx->scr & SCI_SCR_CKE_MASK)
+    );
+}
+
+static uint8_t sci_get_scr(pw_context_t *ctx) {
+    return ctx->scr;
+}
+
+static void sci_set_ssr(pw_context_t *ctx, uint8_t val) {
+    ctx->ssr &= val;
+    //printf("[SCI SSR] %x\n", val);
+}
+
+static uint8_t sci_get_ssr(pw_context_t *ctx) {
+    return 0xBF; //ctx->ssr;
+}
+
+#define SCI_IRCR_IRE_BIT 7
+#define SCI_IRCR_IRCKS_MASK 0x70
+#define SCI_IRCR_IRCKS_SHIFT 4
+#define SCI_IRCR_MASK 0xF0
+
+static uint8_t sci_get_ircr(pw_context_t *ctx) {
+    return ctx->ircr;
+}
+
+static void sci_set_ircr(pw_context_t *ctx, uint8_t val) {
+    ctx->ircr = val & SCI_IRCR_MASK;
+    printf("[SCI IRCR] IRE:%d IRCKS:%d\n", 
+        !!(ctx->ircr & (1 << SCI_IRCR_IRE_BIT)),
+         ((ctx->ircr & SCI_IRCR_IRCKS_MASK) >> SCI_IRCR_IRCKS_SHIFT)
+    );
+}
+
+static uint8_t sci_get_semr(pw_context_t *ctx) {
+    return ctx->semr;
+}
+
+#define SCI_SEMR_MASK 8
+#define SCI_SEMR_ABCS_BIT 3
+
+static void sci_set_semr(pw_context_t *ctx, uint8_t val) {
+    ctx->semr = val & SCI_SEMR_MASK;
+    printf("[SCI SEMR] ABCS:%d\n", 
+        !!(ctx->semr & (1 << SCI_SEMR_ABCS_BIT))
+    );
+}
+
+static uint16_t adc_get_addr(pw_context_t *ctx) {
+    return 0xFFC0;
+}
+
+static uint8_t sys_get_osccr(pw_context_t *ctx) {
+    // OSCF is determined by E7_2 pin
+    //printf("[SYS OSCCR] READ\n");
+    return ctx->osccr;
+}
+
+static void sys_set_osccr(pw_context_t *ctx, uint8_t val) {
+    ctx->osccr = val;
+    // printf("[SYS OSCCR] SUBSTP:%d RFCUT:%d SUBSEL:%d\n", 
+    //     !!(ctx->osccr & (1 << 7)),
+    //     !!(ctx->osccr & (1 << 6)),
+    //     !!(ctx->osccr & (1 << 5))
+    // );
+}
+
+static uint8_t sys_get_pfcr(pw_context_t *ctx) {
+    return ctx->pfcr;
+}
+
+static void sys_set_pfcr(pw_context_t *ctx, uint8_t val) {
+    ctx->pfcr = val;
+    // printf("[SYS PFCR] SSUS:%d IRQ1:%d IRQ0:%d\n", 
+    //     !!(ctx->pfcr & (1 << 4)),
+    //      ((ctx->pfcr >> 2) & 3),
+    //       (ctx->pfcr & 3)
+    // );
+}
+
+#define SYS_SYSCR1_SSBY_BIT 7
+#define SYS_SYSCR1_STS_SHIFT 4
+#define SYS_SYSCR1_STS_MASK 7
+#define SYS_SYSCR1_LSON_BIT 3
+#define SYS_SYSCR1_TMA3_BIT 2
+#define SYS_SYSCR1_MA_MASK 3
+
+static uint8_t sys_get_syscr1(pw_context_t *ctx) {
+    return ctx->syscr1;
+}
+
+static void sys_set_syscr1(pw_context_t *ctx, uint8_t val) {
+    ctx->syscr1 = val;
+    // printf("[SYS SYSCR1] SSBY:%d STS:%d LSON:%d TMA3:%d MA:%d\n", 
+    //     !!(ctx->syscr1 & (1 << SYS_SYSCR1_SSBY_BIT)),
+    //      ((ctx->syscr1 >> SYS_SYSCR1_STS_SHIFT) & SYS_SYSCR1_STS_MASK),
+    //     !!(ctx->syscr1 & (1 << SYS_SYSCR1_LSON_BIT)),
+    //     !!(ctx->syscr1 & (1 << SYS_SYSCR1_TMA3_BIT)),
+    //       (ctx->syscr1 & SYS_SYSCR1_MA_MASK)
+    // );
+}
+
+#define SYS_SYSCR2_NESEL_BIT 4
+#define SYS_SYSCR2_DTON_BIT 3
+#define SYS_SYSCR2_MSON_BIT 2
+#define SYS_SYSCR2_SA_MASK 3
+
+static uint8_t sys_get_syscr2(pw_context_t *ctx) {
+    return ctx->syscr2;
+}
+
+static void sys_set_syscr2(pw_context_t *ctx, uint8_t val) {
+    ctx->syscr2 = val;
+    // printf("[SYS SYSCR2] NESEL:%d DTON:%d MSON:%d SA:%d\n", 
+    //     !!(ctx->syscr2 & (1 << SYS_SYSCR2_NESEL_BIT)),
+    //     !!(ctx->syscr2 & (1 << SYS_SYSCR2_DTON_BIT)),
+    //     !!(ctx->syscr2 & (1 << SYS_SYSCR2_MSON_BIT)),
+    //       (ctx->syscr2 & SYS_SYSCR2_SA_MASK)
+    // );
+}
+
+static uint8_t sys_get_ckstpr1(pw_context_t *ctx) {
+    return ctx->ckstpr1;
+}
+
+static void sys_set_ckstpr1(pw_context_t *ctx, uint8_t val) {
+    ctx->ckstpr1 = val;
+    // printf("[SYS CKSTPR1] S3CKSTP:%d ADCKSTP:%d TB1CKSTP:%d FROMCKSTP:%d RTCCKSTP:%d\n", 
+    //     !!(ctx->ckstpr1 & (1 << 6)),
+    //     !!(ctx->ckstpr1 & (1 << 4)),
+    //     !!(ctx->ckstpr1 & (1 << 2)),
+    //     !!(ctx->ckstpr1 & (1 << 1)),
+    //     !!(ctx->ckstpr1 &  1)
+    // );
+}
+
+static uint8_t sys_get_ckstpr2(pw_context_t *ctx) {
+    return ctx->ckstpr2;
+}
+
+static void sys_set_ckstpr2(pw_context_t *ctx, uint8_t val) {
+    ctx->ckstpr2 = val;
+    // printf("[SYS CKSTPR2] TWCKSTP:%d IICCKSTP:%d SSUCKSTP:%d AECCKSTP:%d WDCKSTP:%d COMPCKSTP:%d\n", 
+    //     !!(ctx->ckstpr2 & (1 << 6)),
+    //     !!(ctx->ckstpr2 & (1 << 5)),
+    //     !!(ctx->ckstpr2 & (1 << 4)),
+    //     !!(ctx->ckstpr2 & (1 << 3)),
+    //     !!(ctx->ckstpr2 & (1 << 2)),
+    //     !!(ctx->ckstpr2 & (1 << 1))
+    // );
+}
+
+const char *exec_modes[] = {
+    "Active (high-speed) mode",
+    "Active (medium-speed) mode",
+    "Subactive mode",
+    "Sleep (high-speed) mode",
+    "Sleep (medium-speed) mode",
+    "Subsleep mode",
+    "Standby mode",
+    "Watch mode"
+};
+
+static int pw_sleeping(pw_context_t *ctx) {
+    return ctx->mode >= MODE_SLEEP_HIGH;
+}
+
+static void sleep_transition(pw_context_t *ctx) {
+    exec_mode_t next;
+    int mson = ctx->syscr2 & (1 << SYS_SYSCR2_MSON_BIT);
+    int ssby = ctx->syscr1 & (1 << SYS_SYSCR1_SSBY_BIT);
+    int tma3 = ctx->syscr1 & (1 << SYS_SYSCR1_TMA3_BIT);
+    int dton = ctx->syscr2 & (1 << SYS_SYSCR2_DTON_BIT);
+
+    // LSON (SYSCR1:3)
+    //   Selects the system clock (φ) or subclock (φSUB) as the
+    //   CPU operating clock when watch mode is cleared.
+    //     0: The CPU operates on the system clock (φ)
+    //     1: The CPU operates on the subclock (φSUB)
+    // MSON (SYSCR2:2)
+    //   After standby, watch, or sleep mode is cleared, this bit
+    //   selects active (high-speed) or active (medium-speed) mode.
+    //     0: Operation in active (high-speed) mode
+    //     1: Operation in active (medium-speed) mode
+    // SSBY (SYSCR1:7)
+    //   Selects the mode to transit after the execution of the
+    //   SLEEP instruction.
+    //     0: A transition is made to sleep mode or subsleep mode.
+    //     1: A transition is made to standby mode or watch mode.
+    // TMA3 (SYSCR1:2)
+    //   Selects the mode to which the transition is made after
+    //   the SLEEP instruction is executed with bits SSBY and
+    //   LSON in SYSCR1 and bits DTON and MSON in SYSCR2.
+    // DTON (SYSCR2:3)
+    //   Selects the mode to which the transition is made after
+    //   the SLEEP instruction is executed with bits SSBY,
+    //   TMA3, and LSON in SYSCR1 and bit MSON in SYSCR2.
+
+    // ACTIVE HIGH =(a)==> SLEEP HIGH
+    // ACTIVE MED  =(a)==> SLEEP HIGH
+    // ACTIVE HIGH =(b)==> SLEEP MED
+    // ACTIVE MED  =(b)==> SLEEP MED
+    // SUBACTIVE   =(c)==> SUBSLEEP
+    // ACTIVE HIGH =(d)==> STANDBY
+    // ACTIVE MED  =(d)==> STANDBY
+    // ACTIVE HIGH =(e)==> WATCH
+    // ACTIVE MED  =(e)==> WATCH
+    // SUBACTIVE   =(e)==> WATCH
+    // ACTIVE MED  =(f)==> ACTIVE HIGH
+    // ACTIVE HIGH =(g)==> ACTIVE MED
+    // SUBACTIVE   =(h)==> ACTIVE MED
+    // ACTIVE HIGH =(i1)=> SUBACTIVE
+    // ACTIVE MED  =(i2)=> SUBACTIVE
+    // SUBACTIVE   =(j)==> ACTIVE HIGH
+
+    // LSON MSON SSBY TMA3 DTON
+    // a : 0 0 0 x 0
+    // b : 0 1 0 x 0
+    // c : 1 x 0 1 0
+    // d : 0 x 1 0 0
+    // e : x x 1 1 0
+    // f : 0 0 0 x 1
+    // g : 0 1 0 x 1
+    // h : 0 1 1 1 1
+    // i1: 1 x 1 1 1
+    // i2: 1 1 1 1 1
+    // j : 0 0 1 1 1
+
+    switch (ctx->mode) {
+        case MODE_ACTIVE_HIGH: // a,b,d,e,g,i1
+        case MODE_ACTIVE_MED: // a,b,d,e,f,i2
+            if (ssby) { // d,e,i1,i2
+                if (tma3) { // e,i1,i2
+                    if (dton) { // i1,i2
+                        next = MODE_SUBACTIVE;
+                    } else { // e
+                        next = MODE_WATCH;
+                    }
+                } else { // d
+                    next = MODE_STANDBY;
+                }
+            } else if (dton) { // f,g
+                next = mson ? MODE_ACTIVE_MED : MODE_ACTIVE_HIGH;
+            } else { // a,b
+                next = mson ? MODE_SLEEP_MED : MODE_SLEEP_HIGH;
+            }
+            break;
+        case MODE_SUBACTIVE: // c,e,h,j
+            if (dton) { // h,j
+                next = mson ? MODE_ACTIVE_MED : MODE_ACTIVE_HIGH;
+            } else if (ssby) { // e
+                next = MODE_WATCH;
+            } else { // c
+                next = MODE_SUBSLEEP;
+            }
+            break;
+        default:
+            return;
+    }
+    // printf("SLEEP %x MSON:%d SSBY:%d TMA3:%d DTON:%d\n[%s] => [%s]\n", 
+    //     ctx->ip,
+    //     !!mson, !!ssby, !!tma3, !!dton,
+    //     exec_modes[ctx->mode], exec_modes[next]);
+    ctx->mode = next;
+    if (pw_sleeping(ctx)) {
+        // the run loop picks this up and skips to the next event
+        ctx->deadline = ctx->states;
+    }
+}
+
+// An interrupt clears sleep, standby and watch mode
+static void wake(pw_context_t *ctx) {
+    int lson = ctx->syscr1 & (1 << SYS_SYSCR1_LSON_BIT);
+    int mson = ctx->syscr2 & (1 << SYS_SYSCR2_MSON_BIT);
+
+    switch (ctx->mode) {
+        case MODE_SUBSLEEP:
+            ctx->mode = MODE_SUBACTIVE;
+            break;
+        case MODE_WATCH:
+            if (lson) {
+                ctx->mode = MODE_SUBACTIVE;
+                break;
+            }
+            // fallthrough
+        case MODE_SLEEP_HIGH:
+        case MODE_SLEEP_MED:
+        case MODE_STANDBY:
+            ctx->mode = mson ? MODE_ACTIVE_MED : MODE_ACTIVE_HIGH;
+            break;
+        default:
+            break;
+    }
+}
+
+// IRQ0 and IRQ1 share bit positions in IEGR, IENR1 and IRR1, and sit on
+// PB0 and PB1 when the matching PMRB bits select them
+#define INT_IRQ_MASK 0x03
+
+static void irq_update(pw_context_t *ctx);
+
+static uint8_t int_get_iegr(pw_context_t *ctx) {
+    return ctx->iegr;
+}
+
+static void int_set_iegr(pw_context_t *ctx, uint8_t val) {
+    ctx->iegr = val;
+}
+
+static uint8_t int_get_ienr1(pw_context_t *ctx) {
+    return ctx->ienr1;
+}
+
+static void int_set_ienr1(pw_context_t *ctx, uint8_t val) {
+    ctx->ienr1 = val;
+    irq_update(ctx);
+}
+
+static uint8_t int_get_ienr2(pw_context_t *ctx) {
+    return ctx->ienr2;
+}
+
+static void int_set_ienr2(pw_context_t *ctx, uint8_t val) {
+    ctx->ienr2 = val;
+}
+
+static uint8_t int_get_irr1(pw_context_t *ctx) {
+    return ctx->irr1;
+}
+
+static void int_set_irr1(pw_context_t *ctx, uint8_t val) {
+    // IRQ flags can only be cleared, they are set by the pins
+    ctx->irr1 = (ctx->irr1 & val & INT_IRQ_MASK) | (val & ~INT_IRQ_MASK);
+}
+
+static uint8_t int_get_irr2(pw_context_t *ctx) {
+    return ctx->irr2;
+}
+
+static void int_set_irr2(pw_context_t *ctx, uint8_t val) {
+    ctx->irr2 = val;
+}
+
+// Scheduler
+
+// the RTC follows the host or emulated clock, check it four times a second
+#define RTC_POLL_STATES (PW_STATES_PER_SECOND / 4)
+
+static inline uint64_t pw_now(pw_context_t *ctx) {
+    return ctx->cycles + ctx->states;
+}
+
+static void update_deadline(pw_context_t *ctx) {
+    uint64_t next = sched_next(&ctx->sched);
+    int deadline = ctx->run_until;
+    if (next < ctx->cycles + deadline) {
+        deadline = next > ctx->cycles ? (int)(next - ctx->cycles) : 0;
+    }
+    ctx->deadline = deadline;
+}
+
+static void pw_schedule(pw_context_t *ctx, enum sched_event ev, uint64_t when) {
+    sched_set(&ctx->sched, ev, when);
+    update_deadline(ctx);
+}
+
+static void pw_unschedule(pw_context_t *ctx, enum sched_event ev) {
+    sched_cancel(&ctx->sched, ev);
+    update_deadline(ctx);
+}
+
+// External interrupts
+
+// Sets the IRQ flags for the pins that saw the edge selected in IEGR,
+// rising when the IEGR bit is set and falling otherwise. Of the buttons
+// only Enter (PB0) is on an IRQ pin; Left (PB2) and Right (PB4) raise no
+// interrupt, so they can't wake a sleeping CPU.
+static void irq_pins_changed(pw_context_t *ctx, uint8_t old, uint8_t new) {
+    uint8_t pins = portb_get_pmrb(&ctx->portb) & INT_IRQ_MASK;
+    uint8_t rising = new & ~old;
+    uint8_t falling = old & ~new;
+    uint8_t edges = ((rising & ctx->iegr) | (falling & ~ctx->iegr)) & pins;
+    if (edges) {
+        ctx->irr1 |= edges;
+        irq_update(ctx);
+    }
+}
+
+// Instructions can't be interrupted halfway, so an enabled request is
+// taken at the next event check. RTC requests are already masked by
+// RTCCR2 when they are raised.
+static void irq_update(pw_context_t *ctx) {
+    if ((ctx->irr1 & ctx->ienr1 & INT_IRQ_MASK) || ctx->rtc.pending_ints) {
+        pw_schedule(ctx, SCHED_IRQ, pw_now(ctx));
+    }
+}
+
+// Timer B1
+static void tb1_set_tmb1(pw_context_t *ctx, uint8_t val) {
+    ctx->tmb1 = val;
+}
+
+static uint8_t tb1_get_tmb1(pw_context_t *ctx) {
+    return ctx->tmb1;
+}
+
+static uint8_t tb1_get_tcb1(pw_context_t *ctx) {
+    return ctx->tmb1;
+}
+
+static void tb1_set_tlb1(pw_context_t *ctx, uint8_t val) {
+    ctx->tlb1 = val;
+}
+
+// Timer W
+
+#define TMRW_TMRW_CTS_BIT 7
+#define TMRW_TMRW_BUFEB_BIT 5
+#define TMRW_TMRW_BUFEA_BIT 4
+#define TMRW_TMRW_PWMD_BIT 2
+#define TMRW_TMRW_PWMC_BIT 1
+#define TMRW_TMRW_PWMB_BIT 0
+#define TMRW_TMRW_MASK 0xB7
+
+// FIXME: should come from TCRW.CKS
+#define TMRW_PRESCALE 100
+
+// TCNT only counts while interrupts are enabled, the handler would
+// otherwise be reentered
+static int tmrw_running(pw_context_t *ctx) {
+    return (ctx->tmrw & (1 << TMRW_TMRW_CTS_BIT)) && ctx->int_enabled;
+}
+
+// Bring TCNT up to date. Must be called before anything that affects
+// counting changes.
+static void tmrw_sync(pw_context_t *ctx) {
+    uint64_t now = pw_now(ctx);
+    if (tmrw_running(ctx)) {
+        uint64_t elapsed = now - ctx->tmrw_synced + ctx->tmrw_rem;
+        ctx->tcnt += elapsed / TMRW_PRESCALE;
+        ctx->tmrw_rem = elapsed % TMRW_PRESCALE;
+    }
+    ctx->tmrw_synced = now;
+}
+
+// Schedule the next compare match A, expects TCNT to be in sync
+static void tmrw_schedule(pw_context_t *ctx) {
+    if (!tmrw_running(ctx)) {
+        pw_unschedule(ctx, SCHED_TMRW);
+        return;
+    }
+    uint32_t ticks = (uint16_t)(ctx->gra - ctx->tcnt);
+    if (ticks == 0) {
+        ticks = 0x10000;
+    }
+    pw_schedule(ctx, SCHED_TMRW, ctx->tmrw_synced + ticks * TMRW_PRESCALE - ctx->tmrw_rem);
+}
+
+static uint8_t tmrw_get_tmrw(pw_context_t *ctx) {
+    return ctx->tmrw;
+}
+
+static void tmrw_set_tmrw(pw_context_t *ctx, uint8_t val) {
+    tmrw_sync(ctx);
+    ctx->tmrw = val & TMRW_TMRW_MASK;
+    tmrw_schedule(ctx);
+    // printf("[TMRW TMRW] CTS:%d BUFEB:%d BUFEA:%d PWMD:%d PWMC:%d PWMB:%d\n", 
+    //     !!(ctx->tmrw & (1 << TMRW_TMRW_CTS_BIT)),
+    //     !!(ctx->tmrw & (1 << TMRW_TMRW_BUFEB_BIT)),
+    //     !!(ctx->tmrw & (1 << TMRW_TMRW_BUFEA_BIT)),
+    //     !!(ctx->tmrw & (1 << TMRW_TMRW_PWMD_BIT)),
+    //     !!(ctx->tmrw & (1 << TMRW_TMRW_PWMC_BIT)),
+    //       (ctx->tmrw & (1 << TMRW_TMRW_PWMB_BIT))
+    // );
+}
+
+#define TMRW_TCRW_CCLR_BIT 7
+#define TMRW_TCRW_CKS_MASK 0x70
+#define TMRW_TCRW_CKS_SHIFT 4
+#define TMRW_TCRW_TOD_BIT 3
+#define TMRW_TCRW_TOC_BIT 2
+#define TMRW_TCRW_TOB_BIT 1
+#define TMRW_TCRW_TOA_BIT 0
+
+static uint8_t tmrw_get_tcrw(pw_context_t *ctx) {
+    return ctx->tcrw;
+}
+
+static void tmrw_set_tcrw(pw_context_t *ctx, uint8_t val) {
+    ctx->tcrw = val;
+    // printf("[TMRW TCRW] CCLR:%d CKS:%d TOD:%d TOC:%d TOB:%d TOA:%d\n", 
+    //     !!(ctx->tcrw & (1 << TMRW_TCRW_CCLR_BIT)),
+    //     (ctx->tcrw & TMRW_TCRW_CKS_MASK) >> TMRW_TCRW_CKS_SHIFT,
+    //     !!(ctx->tcrw & (1 << TMRW_TCRW_TOD_BIT)),
+    //     !!(ctx->tcrw & (1 << TMRW_TCRW_TOC_BIT)),
+    //     !!(ctx->tcrw & (1 << TMRW_TCRW_TOB_BIT)),
+    //       (ctx->tcrw & (1 << TMRW_TCRW_TOA_BIT))
+    // );
+}
+
+#define TMRW_TIERW_OVIE_BIT 7
+#define TMRW_TIERW_IMIED_BIT 3
+#define TMRW_TIERW_IMIEC_BIT 2
+#define TMRW_TIERW_IMIEB_BIT 1
+#define TMRW_TIERW_IMIEA_BIT 0
+#define TMRW_TIERW_MASK 0x8F
+
+static uint8_t tmrw_get_tierw(pw_context_t *ctx) {
+    return ctx->tierw;
+}
+
+static void tmrw_set_tierw(pw_context_t *ctx, uint8_t val) {
+    ctx->tierw = val & TMRW_TIERW_MASK;
+    // printf("[TMRW TIERW] OVIE:%d IMIED:%d IMIEC:%d IMIEB:%d IMIEA:%d\n", 
+    //     !!(ctx->tierw & (1 << TMRW_TIERW_OVIE_BIT)),
+    //     !!(ctx->tierw & (1 << TMRW_TIERW_IMIED_BIT)),
+    //     !!(ctx->tierw & (1 << TMRW_TIERW_IMIEC_BIT)),
+    //     !!(ctx->tierw & (1 << TMRW_TIERW_IMIEB_BIT)),
+    //       (ctx->tierw & (1 << TMRW_TIERW_IMIEA_BIT))
+    // );
+}
+
+#define TMRW_TSRW_OVF_BIT 7
+#define TMRW_TSRW_IMFD_BIT 3
+#define TMRW_TSRW_IMFC_BIT 2
+#define TMRW_TSRW_IMFB_BIT 1
+#define TMRW_TSRW_IMFA_BIT 0
+#define TMRW_TSRW_MASK 0x8F
+
+static uint8_t tmrw_get_tsrw(pw_context_t *ctx) {
+    return ctx->tsrw;
+}
+
+static void tmrw_set_tsrw(pw_context_t *ctx, uint8_t val) {
+    ctx->tsrw &= val | ~TMRW_TSRW_MASK;
+    // printf("[TMRW TSRW] OVF:%d IMFD:%d IMFC:%d IMFB:%d IMFA:%d\n", 
+    //     !!(ctx->tsrw & (1 << TMRW_TSRW_OVF_BIT)),
+    //     !!(ctx->tsrw & (1 << TMRW_TSRW_IMFD_BIT)),
+    //     !!(ctx->tsrw & (1 << TMRW_TSRW_IMFC_BIT)),
+    //     !!(ctx->tsrw & (1 << TMRW_TSRW_IMFB_BIT)),
+    //       (ctx->tsrw & (1 << TMRW_TSRW_IMFA_BIT))
+    // );
+}
+
+#define TMRW_TIOR0_IOB_MASK 0x70
+#define TMRW_TIOR0_IOB_SHIFT 4
+#define TMRW_TIOR0_IOA_MASK 7
+#define TMRW_TIOR0_IOA_SHIFT 0
+#define TMRW_TIOR0_MASK 0x77
+
+static uint8_t tmrw_get_tior0(pw_context_t *ctx) {
+    return ctx->tior0;
+}
+
+static void tmrw_set_tior0(pw_context_t *ctx, uint8_t val) {
+    ctx->tior0 = val & TMRW_TIOR0_MASK;
+    // printf("[TMRW TIOR0] IOB:%d IOA:%d\n", 
+    //     (ctx->tior0 & TMRW_TIOR0_IOB_MASK) >> TMRW_TIOR0_IOB_SHIFT,
+    //     (ctx->tior0 & TMRW_TIOR0_IOA_MASK) >> TMRW_TIOR0_IOA_SHIFT
+    // );
+}
+
+#define TMRW_TIOR1_IOD_MASK 0x70
+#define TMRW_TIOR1_IOD_SHIFT 4
+#define TMRW_TIOR1_IOC_MASK 7
+#define TMRW_TIOR1_IOC_SHIFT 0
+#define TMRW_TIOR1_MASK 0x77
+
+static uint8_t tmrw_get_tior1(pw_context_t *ctx) {
+    return ctx->tior1;
+}
+
+static void tmrw_set_tior1(pw_context_t *ctx, uint8_t val) {
+    ctx->tior1 = val & TMRW_TIOR1_MASK;
+    // printf("[TMRW TIOR1] IOD:%d IOC:%d\n", 
+    //     (ctx->tior1 & TMRW_TIOR1_IOD_MASK) >> TMRW_TIOR1_IOD_SHIFT,
+    //     (ctx->tior1 & TMRW_TIOR1_IOC_MASK) >> TMRW_TIOR1_IOC_SHIFT
+    // );
+}
+
+static uint16_t tmrw_get_tcnt(pw_context_t *ctx) {
+    tmrw_sync(ctx);
+    return ctx->tcnt;
+}
+
+static void tmrw_set_tcnt(pw_context_t *ctx, uint16_t val) {
+    tmrw_sync(ctx);
+    ctx->tcnt = val;
+    tmrw_schedule(ctx);
+    // printf("[TMRW TCNT] %x\n", val);
+}
+
+static uint16_t tmrw_get_gra(pw_context_t *ctx) {
+    return ctx->gra;
+}
+
+static void tmrw_set_gra(pw_context_t *ctx, uint16_t val) {
+    tmrw_sync(ctx);
+    ctx->gra = val;
+    tmrw_schedule(ctx);
+    // printf("[TMRW GRA] %x @ %x\n", val, ctx->ip);
+}
+
+static uint16_t tmrw_get_grb(pw_context_t *ctx) {
+    return ctx->grb;
+}
+
+static void tmrw_set_grb(pw_context_t *ctx, uint16_t val) {
+    ctx->grb = val;
+    // printf("[TMRW GRB] %x\n", val);
+}
+
+static uint16_t tmrw_get_grc(pw_context_t *ctx) {
+    return ctx->grc;
+}
+
+static void tmrw_set_grc(pw_context_t *ctx, uint16_t val) {
+    ctx->grc = val;
+    // printf("[TMRW GRC] %x\n", val);
+}
+
+static uint16_t tmrw_get_grd(pw_context_t *ctx) {
+    return ctx->grd;
+}
+
+static void tmrw_set_grd(pw_context_t *ctx, uint16_t val) {
+    ctx->grd = val;
+    // printf("[TMRW GRD] %x\n", val);
+}
+
+static const mm_reg_t mm_registers[] = {
+MM_REG8("FLMCR1",  0xF020, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Flash memory control register 1", 0),
+MM_REG8("FLMCR2",  0xF021, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Flash memory control register 2", 0),
+MM_REG8("FLPWCR",  0xF022, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Flash memory power control register", 0),
+MM_REG8("EBR1",    0xF023, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Erase block register 1", 0),
+MM_REG8("FENR",    0xF02B, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Flash memory enable register", 0),
+MM_REG8("RTCFLG",  0xF067, REGTYPE_DBW8_ACCS2,  rtc_get_flg, rtc_set_flg, "RTC interrupt flag register", offsetof(pw_context_t, rtc)),
+MM_REG8("RSECDR",  0xF068, REGTYPE_DBW8_ACCS2,  rtc_get_secdr, rtc_set_secdr, "Second data register/free running counter data register", offsetof(pw_context_t, rtc)),
+MM_REG8("RMINDR",  0xF069, REGTYPE_DBW8_ACCS2,  rtc_get_mindr, rtc_set_mindr, "Minute data register", offsetof(pw_context_t, rtc)),
+MM_REG8("RHRDR",   0xF06A, REGTYPE_DBW8_ACCS2,  rtc_get_hrdr, rtc_set_hrdr, "Hour data register", offsetof(pw_context_t, rtc)),
+MM_REG8("RWKDR",   0xF06B, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Day-of-week data register", offsetof(pw_context_t, rtc)),
+MM_REG8("RTCCR1",  0xF06C, REGTYPE_DBW8_ACCS2,  rtc_get_cr1, rtc_set_cr1, "RTC control register 1", offsetof(pw_context_t, rtc)),
+MM_REG8("RTCCR2",  0xF06D, REGTYPE_DBW8_ACCS2,  rtc_get_cr2, rtc_set_cr2, "RTC control register 2", offsetof(pw_context_t, rtc)),
+MM_REG8("RTCCSR",  0xF06F, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Clock source select register", offsetof(pw_context_t, rtc)),
+MM_REG8("ICCR1",   0xF078, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus control register 1", 0),
+MM_REG8("ICCR2",   0xF079, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus control register 2", 0),
+MM_REG8("ICMR",    0xF07A, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus mode register", 0),
+MM_REG8("ICIER",   0xF07B, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus interrupt enable register", 0),
+MM_REG8("ICSR",    0xF07C, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus status register", 0),
+MM_REG8("SAR",     0xF07D, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Slave address register", 0),
+MM_REG8("ICDRT",   0xF07E, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus transmit data register", 0),
+MM_REG8("ICDRR",   0xF07F, REGTYPE_DBW8_ACCS2,  NULL, NULL, "I2C bus receive data register", 0),
+MM_REG8("PFCR",    0xF085, REGTYPE_DBW8_ACCS2,  sys_get_pfcr, sys_set_pfcr, "Port function control register", 0),
+MM_REG8("PUCR8",   0xF086, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port pull-up control register 8", 0),
+MM_REG8("PUCR9",   0xF087, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port pull-up control register 9", 0),
+MM_REG8("UNK_REG", 0xF088, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Unknown IO Reg (TODO?)", 0),
+MM_REG8("PODR9",   0xF08C, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port open-drain control register 9", 0),
+MM_REG8("TMB1",    0xF0D0, REGTYPE_DBW8_ACCS2,  tb1_get_tmb1, tb1_set_tmb1, "Timer mode register B1", 0),
+MM_REG8("TCB1 (R)/TLB1 (W)", 0xF0D1, REGTYPE_DBW8_ACCS2,  tb1_get_tcb1, tb1_set_tlb1, "Timer counter B1/Timer load register B1", 0),
+MM_REG8("CMCR0",   0xF0DC, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Compare control register 0", 0),
+MM_REG8("CMCR1",   0xF0DD, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Compare control register 1", 0),
+MM_REG8("CMDR",    0xF0DE, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Compare data register", 0),
+MM_REG8("SSCRH",   0xF0E0, REGTYPE_DBW8_ACCS3,  ssu_get_sscrh, ssu_set_sscrh, "SS control register H", offsetof(pw_context_t, ssu)),
+MM_REG8("SSCRL",   0xF0E1, REGTYPE_DBW8_ACCS3,  ssu_get_sscrl, ssu_set_sscrl, "SS control register L", offsetof(pw_context_t, ssu)),
+MM_REG8("SSMR",    0xF0E2, REGTYPE_DBW8_ACCS3,  ssu_get_ssmr, ssu_set_ssmr, "SS mode register", offsetof(pw_context_t, ssu)),
+MM_REG8("SSER",    0xF0E3, REGTYPE_DBW8_ACCS3,  ssu_get_sser, ssu_set_sser, "SS enable register", offsetof(pw_context_t, ssu)),
+MM_REG8("SSSR",    0xF0E4, REGTYPE_DBW8_ACCS3,  ssu_get_sssr, ssu_set_sssr, "SS status register", offsetof(pw_context_t, ssu)),
+MM_REG8("SSRDR",   0xF0E9, REGTYPE_DBW8_ACCS3,  ssu_get_ssrdr, NULL, "SS receive data register", offsetof(pw_context_t, ssu)),
+MM_REG8("SSTDR",   0xF0EB, REGTYPE_DBW8_ACCS3,  ssu_get_sstdr, ssu_set_sstdr, "SS transmit data register", offsetof(pw_context_t, ssu)),
+MM_REG8("TMRW",    0xF0F0, REGTYPE_DBW8_ACCS2,  tmrw_get_tmrw, tmrw_set_tmrw, "Timer mode register W", 0),
+MM_REG8("TCRW",    0xF0F1, REGTYPE_DBW8_ACCS2,  tmrw_get_tcrw, tmrw_set_tcrw, "Timer control register W", 0),
+MM_REG8("TIERW",   0xF0F2, REGTYPE_DBW8_ACCS2,  tmrw_get_tierw, tmrw_set_tierw, "Timer interrupt enable register W", 0),
+MM_REG8("TSRW",    0xF0F3, REGTYPE_DBW8_ACCS2,  tmrw_get_tsrw, tmrw_set_tsrw, "Timer status register W", 0),
+MM_REG8("TIOR0",   0xF0F4, REGTYPE_DBW8_ACCS2,  tmrw_get_tior0, tmrw_set_tior0, "Timer I/O control register 0", 0),
+MM_REG8("TIOR1",   0xF0F5, REGTYPE_DBW8_ACCS2,  tmrw_get_tior1, tmrw_set_tior1, "Timer I/O control register 1", 0),
+MM_REG16("TCNT",   0xF0F6, REGTYPE_DBW16_ACCS2, tmrw_get_tcnt, tmrw_set_tcnt, "Timer counter", 0),
+MM_REG16("GRA",    0xF0F8, REGTYPE_DBW16_ACCS2, tmrw_get_gra, tmrw_set_gra, "General register A", 0),
+MM_REG16("GRB",    0xF0FA, REGTYPE_DBW16_ACCS2, tmrw_get_grb, tmrw_set_grb, "General register B", 0),
+MM_REG16("GRC",    0xF0FC, REGTYPE_DBW16_ACCS2, tmrw_get_grc, tmrw_set_grc, "General register C", 0),
+MM_REG16("GRD",    0xF0FE, REGTYPE_DBW16_ACCS2, tmrw_get_grd, tmrw_set_grd, "General register D", 0),
+MM_REG16("ECPWCR", 0xFF8C, REGTYPE_DBW16_ACCS2, NULL, NULL, "Event counter PWM compare register", 0),
+MM_REG16("ECPWDR", 0xFF8E, REGTYPE_DBW16_ACCS2, NULL, NULL, "Event counter PWM data register", 0),
+MM_REG8("SPCR",    0xFF91, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Serial port control register", 0),
+MM_REG8("AEGSR",   0xFF92, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Input pin edge select register", 0),
+MM_REG8("ECCR",    0xFF94, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Event counter control register", 0),
+MM_REG8("ECCSR",   0xFF95, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Event counter control/status register", 0),
+MM_REG8("ECH",     0xFF96, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Event counter H", 0),
+MM_REG8("ECL",     0xFF97, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Event counter L", 0),
+MM_REG8("SMR3",    0xFF98, REGTYPE_DBW8_ACCS3,  sci_get_smr, sci_set_smr, "Serial mode register 3", 0),
+MM_REG8("BRR3",    0xFF99, REGTYPE_DBW8_ACCS3,  NULL, NULL, "Bit rate register 3", 0),
+MM_REG8("SCR3",    0xFF9A, REGTYPE_DBW8_ACCS3,  sci_get_scr, sci_set_scr, "Serial control register 3", 0),
+MM_REG8("TDR3",    0xFF9B, REGTYPE_DBW8_ACCS3,  sci_get_tdr, sci_set_tdr, "Transmit data register 3", 0),
+MM_REG8("SSR3",    0xFF9C, REGTYPE_DBW8_ACCS3,  sci_get_ssr, sci_set_ssr, "Serial status register 3", 0),
+MM_REG8("RDR3",    0xFF9D, REGTYPE_DBW8_ACCS3,  sci_get_rdr, NULL, "Receive data register 3", 0),
+MM_REG8("SEMR",    0xFFA6, REGTYPE_DBW8_ACCS3,  sci_get_semr, sci_set_semr, "Serial extended mode register", 0),
+MM_REG8("IrCR",    0xFFA7, REGTYPE_DBW8_ACCS2,  sci_get_ircr, sci_set_ircr, "IrDA control register", 0),
+MM_REG8("TMWD",    0xFFB0, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Timer mode register WD", 0),
+MM_REG8("TCSRWD1", 0xFFB1, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Timer control/status register WD1", 0),
+MM_REG8("TCSRWD2", 0xFFB2, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Timer control/status register WD2", 0),
+MM_REG8("TCWD",    0xFFB3, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Timer counter WD", 0),
+MM_REG16("ADRR",   0xFFBC, REGTYPE_DBW16_ACCS2, adc_get_addr, NULL, "A/D result register", 0),
+MM_REG8("AMR",     0xFFBE, REGTYPE_DBW8_ACCS2,  NULL, NULL, "A/D mode register", 0),
+MM_REG8("ADSR",    0xFFBF, REGTYPE_DBW8_ACCS2,  NULL, NULL, "A/D start register", 0),
+MM_REG8("PMR1",    0xFFC0, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port mode register 1", 0),
+MM_REG8("PMR3",    0xFFC2, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port mode register 3", 0),
+MM_REG8("PMRB",    0xFFCA, REGTYPE_DBW8_ACCS2,  portb_get_pmrb, portb_set_pmrb, "Port mode register B", offsetof(pw_context_t, portb)),
+MM_REG8("PDR1",    0xFFD4, REGTYPE_DBW8_ACCS2,  io2_get_pdr1, io2_set_pdr1, "Port data register 1", 0),
+MM_REG8("PDR3",    0xFFD6, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port data register 3", 0),
+MM_REG8("PDR8",    0xFFDB, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port data register 8", 0),
+MM_REG8("PDR9",    0xFFDC, REGTYPE_DBW8_ACCS2,  io2_get_pdr9, io2_set_pdr9, "Port data register 9", 0),
+MM_REG8("PDRB",    0xFFDE, REGTYPE_DBW8_ACCS2,  portb_get_pdrb, NULL, "Port data register B", offsetof(pw_context_t, portb)),
+MM_REG8("PUCR1",   0xFFE0, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port pull-up control register 1", 0),
+MM_REG8("PUCR3",   0xFFE1, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port pull-up control register 3", 0),
+MM_REG8("PCR1",    0xFFE4, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port control register 1", 0),
+MM_REG8("PCR3",    0xFFE6, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port control register 3", 0),
+MM_REG8("PCR8",    0xFFEB, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port control register 8", 0),
+MM_REG8("PCR9",    0xFFEC, REGTYPE_DBW8_ACCS2,  NULL, NULL, "Port control register 9", 0),
+MM_REG8("SYSCR1",  0xFFF0, REGTYPE_DBW8_ACCS2,  sys_get_syscr1, sys_set_syscr1, "System control register 1", 0),
+MM_REG8("SYSCR2",  0xFFF1, REGTYPE_DBW8_ACCS2,  sys_get_syscr2, sys_set_syscr2, "System control register 2", 0),
+MM_REG8("IEGR",    0xFFF2, REGTYPE_DBW8_ACCS2,  int_get_iegr, int_set_iegr, "Interrupt edge select register", 0),
+MM_REG8("IENR1",   0xFFF3, REGTYPE_DBW8_ACCS2,  int_get_ienr1, int_set_ienr1, "Interrupt enable register 1", 0),
+MM_REG8("IENR2",   0xFFF4, REGTYPE_DBW8_ACCS2,  int_get_ienr2, int_set_ienr2, "Interrupt enable register 2", 0),
+MM_REG8("OSCCR",   0xFFF5, REGTYPE_DBW8_ACCS2,  sys_get_osccr, sys_set_osccr, "Oscillator control register", 0),
+MM_REG8("IRR1",    0xFFF6, REGTYPE_DBW8_ACCS2,  int_get_irr1, int_set_irr1, "Interrupt flag register 1", 0),
+MM_REG8("IRR2",    0xFFF7, REGTYPE_DBW8_ACCS2,  int_get_irr2, int_set_irr2, "Interrupt flag register 2", 0),
+MM_REG8("CKSTPR1", 0xFFFA, REGTYPE_DBW8_ACCS2,  sys_get_ckstpr1, sys_set_ckstpr1, "Clock stop register 1", 0),
+MM_REG8("CKSTPR2", 0xFFFB, REGTYPE_DBW8_ACCS2,  sys_get_ckstpr2, sys_set_ckstpr2, "Clock stop register 2", 0),
+};
+
+#define NUM_MM_REGISTERS (sizeof(mm_registers) / sizeof(mm_registers[0]))
+
+// Direct lookup table for both I/O areas. The high byte of a 16-bit
+// register also maps to it, so unaligned accesses find the register too.
+// It only depends on mm_registers, so all instances share it; the first
+// pw_create builds it.
+static const mm_reg_t *io_regs[IO1_SIZE + IO2_SIZE];
+// 0 not built, 1 being built, 2 ready
+static uint32_t io_regs_state;
+
+static void mm_reg_map_init(void) {
+    if (load_acquire(&io_regs_state) == 2) {
+        return;
+    }
+    if (!cas32(&io_regs_state, 0, 1)) {
+        // another thread is building it, which is quick
+        while (load_acquire(&io_regs_state) != 2) {
+        }
+        return;
+    }
+    for (size_t i = 0; i < NUM_MM_REGISTERS; i++) {
+        const mm_reg_t *reg = &mm_registers[i];
+        uint16_t addr = reg->addr;
+        uint16_t idx = addr < IO2_start ? addr - IO1_start : addr - IO2_start + IO1_SIZE;
+        io_regs[idx] = reg;
+        if (reg->type == REGTYPE_DBW16_ACCS2 && io_regs[idx + 1] == NULL) {
+            io_regs[idx + 1] = reg;
+        }
+    }
+    store_release(&io_regs_state, 2);
+}
+
+static const mm_reg_t *find_mm_reg(pw_context_t *ctx, uint16_t addr) {
+    if (addr >= IO1_start && addr < IO1_end) {
+        return io_regs[addr - IO1_start];
+    } else if (addr >= IO2_start) {
+        return io_regs[addr - IO2_start + IO1_SIZE];
+    }
+    return NULL;
+}
+
+enum grayscale {
+    WHITE, LIGHT_GRAY, DARK_GRAY, BLACK
+};
+
+#define RGBA(r,g,b,a) (((a) << 24) | ((r) << 16) | ((g) << 8) | (b))
+static const uint32_t colors[] = {
+    RGBA(172, 174, 163, 255),
+    RGBA(128, 130, 116, 255),
+    RGBA(92, 92, 82, 255),
+    RGBA(30, 25, 22, 255)
+};
+
+char branch_mnemonics[16][4] = {
+    "bra", "brn", "bhi", "bls", "bcc", "bcs", "bne", "beq",
+    "bvc", "bvs", "bpl", "bmi", "bge", "blt", "bgt", "ble"
+};
+
+static uint32_t sign16_32(uint16_t val) {
+    if (val & (1 << 15)) {
+        return val | 0xFFFF0000;
+    } else {
+        return val;
+    }
+}
+
+static uint32_t sign8_32(uint8_t val) {
+    if (val & (1 << 7)) {
+        return val | 0xFFFFFF00;
+    } else {
+        return val;
+    }
+}
+
+static uint16_t sign8_16(uint8_t val) {
+    if (val & (1 << 7)) {
+        return val | 0xFF00;
+    } else {
+        return val;
+    }
+}
+
+#define ABS8(x)  (0xFFFF00 | x)
+#define ABS16(x) x
+//#define ABS16(x) sign16_32(x)
+#define ABS24(x) x
+#define DISPI32(disp, reg) (read_reg32(ctx, reg) + (int32_t)disp)
+#define DISPI16(disp, reg) (read_reg32(ctx, reg) + (int32_t)sign16_32(disp))
+
+enum ccr_bit { 
+    CCR_C, CCR_V, CCR_Z, CCR_N, CCR_U1,
+    CCR_H, CCR_U2, CCR_I
+};
+
+enum reg32 {
+    ER0, ER1, ER2, ER3, ER4, ER5, ER6, ER7
+};
+
+#define ER_SP ER7
+
+enum reg16 {
+    R0, R1, R2, R3, R4, R5, R6, R7,
+    E0, E1, E2, E3, E4, E5, E6, E7
+};
+
+enum reg8 {
+    R0H, R1H, R2H, R3H, R4H, R5H, R6H, R7H,
+    R0L, R1L, R2L, R3L, R4L, R5L, R6L, R7L
+};
+
+static uint32_t read_reg32(pw_context_t *ctx, uint32_t reg) {
+    assert(reg < 8);
+    return (ctx->regs[reg+8] << 16) | ctx->regs[reg];
+}
+
+static uint16_t read_reg16(pw_context_t *ctx, uint32_t reg) {
+    assert(reg < 16);
+    return ctx->regs[reg];
+}
+
+static uint8_t read_reg8(pw_context_t *ctx, uint32_t reg) {
+    assert(reg < 16);
+    return ctx->regs[reg & 0b111] >> ((reg & 8) ? 0 : 8);
+}
+
+static void write_reg32(pw_context_t *ctx, uint32_t reg, uint32_t value) {
+    assert(reg < 8);
+    ctx->regs[reg+8] = value >> 16;
+    ctx->regs[reg]   = value;
+}
+
+static void write_reg16(pw_context_t *ctx, uint32_t reg, uint16_t value) {
+    assert(reg < 16);
+    ctx->regs[reg] = value;
+}
+
+static void write_reg8(pw_context_t *ctx, uint32_t reg, uint8_t value) {
+    assert(reg < 16);
+    int shift = (reg & 8) ? 0 : 8;
+    ctx->regs[reg & 0b111] &= 0xFF  << (8 - shift);
+    ctx->regs[reg & 0b111] |= value << shift;
+}
+
+// FIXME
+#define CARRY_AT(a, b, n)  (((a & ((1<<n)-1)) + (b & ((1<<n)-1))) > ((1<<n)-1))
+#define BORROW_AT(a, b, n) (b > a)
+#define OVERFLOW_SUB(a, b, r, sign_bit) (((a ^ b)&(a ^ r)) >> sign_bit)
+#define OVERFLOW_ADD(a, b, r, sign_bit) (((~(a ^ b))&(a ^ r)) >> sign_bit)
+
+// Lazy condition codes
+//
+// The ALU helpers only record what they did, the CCR bits are computed when
+// something actually looks at them. Most flags get overwritten by the next
+// instruction before anyone reads them. Build with PW_EAGER_FLAGS to
+// evaluate them right away.
+
+#define CCR_MASK(bit) (1 << (bit))
+#define CCR_NZV   (CCR_MASK(CCR_N) | CCR_MASK(CCR_Z) | CCR_MASK(CCR_V))
+#define CCR_NZVC  (CCR_NZV | CCR_MASK(CCR_C))
+#define CCR_HNZVC (CCR_NZVC | CCR_MASK(CCR_H))
+
+// bits of the CCR each kind of operation writes
+static const uint8_t flags_mask[] = {
+    [FLAGS_NONE]  = 0,
+    [FLAGS_MOV8]  = CCR_NZV,
+    [FLAGS_MOV16] = CCR_NZV,
+    [FLAGS_MOV32] = CCR_NZV,
+    [FLAGS_SUB8]  = CCR_HNZVC,
+    [FLAGS_SUB16] = CCR_HNZVC,
+    [FLAGS_SUB32] = CCR_HNZVC,
+    [FLAGS_SHL8]  = CCR_NZVC,
+    [FLAGS_SHL16] = CCR_NZVC,
+    [FLAGS_SHL32] = CCR_NZVC,
+    [FLAGS_SHR8]  = CCR_NZVC,
+    [FLAGS_SHR16] = CCR_NZVC,
+    [FLAGS_SHR32] = CCR_NZVC,
+    [FLAGS_ROTL8] = CCR_NZVC,
+    [FLAGS_ROTL16] = CCR_NZVC,
+    [FLAGS_DEC8]  = CCR_NZV,
+    [FLAGS_DEC16] = CCR_NZV,
+};
+
+#define CCR_BIT(bit, x) ((uint8_t)(!!(x)) << (bit))
+
+static void flags_eval(pw_context_t *ctx) {
+    uint32_t a = ctx->flags_a;
+    uint32_t b = ctx->flags_b;
+    uint32_t r = ctx->flags_res;
+    uint8_t bits;
+
+    switch (ctx->flags_op) {
+        case FLAGS_NONE:
+            return;
+        case FLAGS_MOV8:
+            bits = CCR_BIT(CCR_N, r & 0x80) | CCR_BIT(CCR_Z, (r & 0xFF) == 0);
+            break;
+        case FLAGS_MOV16:
+            bits = CCR_BIT(CCR_N, r & 0x8000) | CCR_BIT(CCR_Z, (r & 0xFFFF) == 0);
+            break;
+        case FLAGS_MOV32:
+            bits = CCR_BIT(CCR_N, r & 0x80000000) | CCR_BIT(CCR_Z, r == 0);
+            break;
+        case FLAGS_SUB8:
+            bits = CCR_BIT(CCR_H, BORROW_AT(a, b, 3)) | CCR_BIT(CCR_N, r >> 7) | CCR_BIT(CCR_Z, r == 0)
+                 | CCR_BIT(CCR_V, OVERFLOW_SUB(a, b, r, 7)) | CCR_BIT(CCR_C, BORROW_AT(a, b, 7));
+            break;
+        case FLAGS_SUB16:
+            bits = CCR_BIT(CCR_H, BORROW_AT(a, b, 11)) | CCR_BIT(CCR_N, r >> 15) | CCR_BIT(CCR_Z, r == 0)
+                 | CCR_BIT(CCR_V, OVERFLOW_SUB(a, b, r, 15)) | CCR_BIT(CCR_C, BORROW_AT(a, b, 15));
+            break;
+        case FLAGS_SUB32:
+            bits = CCR_BIT(CCR_H, BORROW_AT(a, b, 27)) | CCR_BIT(CCR_N, r >> 31) | CCR_BIT(CCR_Z, r == 0)
+                 | CCR_BIT(CCR_V, OVERFLOW_SUB(a, b, r, 31)) | CCR_BIT(CCR_C, BORROW_AT(a, b, 31));
+            break;
+        // FIXME: N comes from the operand instead of the result, same as before
+        case FLAGS_SHL8:
+            bits = CCR_BIT(CCR_N, a >> 7) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, r >> 7);
+            break;
+        case FLAGS_SHL16:
+            bits = CCR_BIT(CCR_N, a >> 15) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, r >> 15);
+            break;
+        case FLAGS_SHL32:
+            bits = CCR_BIT(CCR_N, a >> 31) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, r >> 31);
+            break;
+        case FLAGS_SHR8:
+        case FLAGS_SHR16:
+        case FLAGS_SHR32:
+            bits = CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, a & 1);
+            break;
+        case FLAGS_ROTL8:
+            bits = CCR_BIT(CCR_N, r >> 7) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, a >> 7);
+            break;
+        case FLAGS_ROTL16:
+            bits = CCR_BIT(CCR_N, r >> 15) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_C, a >> 15);
+            break;
+        case FLAGS_DEC8:
+            bits = CCR_BIT(CCR_N, r & 0x80) | CCR_BIT(CCR_Z, r == 0) | CCR_BIT(CCR_V, r + 1 == 0x80);
+            break;
+        case FLAGS_DEC16:
+            // FIXME: Z is tested on the operand and V is never set, same as before
+            bits = CCR_BIT(CCR_N, r & 0x8000) | CCR_BIT(CCR_Z, a == 0);
+            break;
+        default:
+            assert(0);
+            return;
+    }
+    ctx->ccr = (ctx->ccr & ~flags_mask[ctx->flags_op]) | bits;
+    ctx->flags_op = FLAGS_NONE;
+}
+
+static void set_flags(pw_context_t *ctx, enum flags_op op, uint32_t a, uint32_t b, uint32_t res) {
+    // the pending operation has to be evaluated if the new one doesn't
+    // overwrite all of its bits
+    if (flags_mask[ctx->flags_op] & ~flags_mask[op]) {
+        flags_eval(ctx);
+    }
+    ctx->flags_op  = op;
+    ctx->flags_a   = a;
+    ctx->flags_b   = b;
+    ctx->flags_res = res;
+#ifdef PW_EAGER_FLAGS
+    flags_eval(ctx);
+#endif
+}
+
+static uint8_t get_ccr(pw_context_t *ctx) {
+    flags_eval(ctx);
+    return ctx->ccr;
+}
+
+static void set_ccr(pw_context_t *ctx, uint8_t nccr) {
+    ctx->flags_op = FLAGS_NONE;
+    ctx->ccr = nccr & 0xFF;
+}
+
+static int get_ccr_bit(pw_context_t *ctx, enum ccr_bit bit) {
+    flags_eval(ctx);
+    return (ctx->ccr >> bit) & 1;
+}
+
+static void set_ccr_bit(pw_context_t *ctx, enum ccr_bit bit, int x) {
+    flags_eval(ctx);
+    ctx->ccr ^= (-x ^ ctx->ccr) & (1UL << bit);
+}
+
+static uint8_t peek8(pw_context_t *ctx, uint16_t addr) {
+    addr &= 0xFFFF;
+    if (addr <= ROM_end) {
+        return ctx->rom[addr];
+    } else if (addr >= RAM_start && addr < RAM_end) {
+        return ctx->ram[addr - RAM_start];
+    }
+    return 0;
+}
+
+static uint16_t peek16(pw_context_t *ctx, uint32_t addr) {
+    addr &= 0xFFFF;
+    if (addr <= ROM_end - 1) {
+        return (ctx->rom[addr] << 8) | ctx->rom[addr+1];
+    } else if (addr >= RAM_start && addr < RAM_end - 1) {
+        return (ctx->ram[addr - RAM_start] << 8) | ctx->ram[addr - RAM_start + 1];
+    }
+    return 0;
+}
+
+static uint32_t peek24(pw_context_t *ctx, uint32_t addr) {
+    return (peek16(ctx, addr) << 8) | peek8(ctx, addr+2);
+}
+
+static uint32_t peek32(pw_context_t *ctx, uint32_t addr) {
+    return (peek16(ctx, addr) << 16) | peek16(ctx, addr+2);
+}
+
+#define INTERNAL_STATES(i) ctx->internal_states += i; ctx->states += i;
+#define ON_CHIP_MEM_ACCESS ctx->states += 2;
+#define ON_CHIP_MOD8_2_ACCESS ctx->states += 2;
+#define ON_CHIP_MOD8_3_ACCESS ctx->states += 3;
+#define ON_CHIP_MOD16_2_ACCESS ctx->states += 2;
+
+// Page table for the 64K address space. ROM and RAM pages point straight
+// into the context, everything else (I/O, unmapped memory, RAM with hacks
+// on it) is NULL and goes through the slow path below.
+static void memmap_init(pw_context_t *ctx) {
+    for (int p = 0; p < NUM_PAGES; p++) {
+        uint32_t start = p << PAGE_SHIFT;
+        uint32_t end   = start + PAGE_SIZE - 1;
+        ctx->read_pages[p]  = NULL;
+        ctx->write_pages[p] = NULL;
+        if (end <= ROM_end) {
+            ctx->read_pages[p] = &ctx->rom[start];
+        } else if (start >= RAM_start && end < RAM_end) {
+            ctx->read_pages[p]  = &ctx->ram[start - RAM_start];
+            ctx->write_pages[p] = &ctx->ram[start - RAM_start];
+        }
+    }
+    // reads of these are patched in read8_slow/read16_slow
+    ctx->read_pages[0xF7B5 >> PAGE_SHIFT] = NULL;
+    ctx->read_pages[0xF78E >> PAGE_SHIFT] = NULL;
+}
+
+static uint8_t read8_slow(pw_context_t *ctx, uint16_t addr) {
+    if (addr <= ROM_end) {
+        ON_CHIP_MEM_ACCESS;
+        return ctx->rom[addr];
+    } else if (addr >= RAM_start && addr < RAM_end) {
+        ON_CHIP_MEM_ACCESS;
+        // if (addr == 0xF7C4) {
+        //     // hack to get into main event loop
+        //     return 1;
+        // }
+        if (addr == 0xF7B5) { // common_bit_flags
+            return (ctx->ram[addr - RAM_start] | 1UL) & ~(1 << 4);
+        }
+        return ctx->ram[addr - RAM_start];
+    } else if ((addr >= IO1_start && addr < IO1_end) || (addr >= IO2_start && addr < IO2_end)) {
+        const mm_reg_t *reg = find_mm_reg(ctx, addr);
+        if (reg && reg->type != REGTYPE_DBW16_ACCS2) {
+            if (reg->read8) {
+                if (reg->type == REGTYPE_DBW8_ACCS2) {
+                    ON_CHIP_MOD8_2_ACCESS;
+                } else {
+                    ON_CHIP_MOD8_3_ACCESS;
+                }
+                return reg->read8(((uintptr_t)ctx) + reg->ctx_offset);
+            }
+            UNIMPL("read8: unimplemented register %s [%x]\n", reg->name, ctx->ip);
+            return 0;
+        }
+    }
+    debug("read8: Unknown addr %x\n", addr);
+    exit(0);
+}
+
+static uint8_t read8(pw_context_t *ctx, uint16_t addr) {
+    ctx->byte_access++;
+    const uint8_t *page = ctx->read_pages[addr >> PAGE_SHIFT];
+    if (likely(page != NULL)) {
+        ON_CHIP_MEM_ACCESS;
+        return page[addr & PAGE_MASK];
+    }
+    return read8_slow(ctx, addr);
+}
+
+static uint16_t read16_slow(pw_context_t *ctx, uint16_t addr) {
+    if (addr <= ROM_end - 1) {
+        ON_CHIP_MEM_ACCESS;
+        return (ctx->rom[addr] << 8) | ctx->rom[addr+1];
+    } else if (addr >= RAM_start && addr < RAM_end - 1) {
+        ON_CHIP_MEM_ACCESS;
+        if (addr == 0xF78E) { // watts
+            return 132;
+        }
+        return (ctx->ram[addr - RAM_start] << 8) | ctx->ram[addr - RAM_start + 1];
+    } else if ((addr >= IO1_start && addr < IO1_end - 1) || (addr >= IO2_start && addr < IO2_end - 1)) {
+        const mm_reg_t *reg = find_mm_reg(ctx, addr);
+        if (reg && reg->type == REGTYPE_DBW16_ACCS2) {
+            if (reg->read16) {
+                ON_CHIP_MOD16_2_ACCESS;
+                return reg->read16(((uintptr_t)ctx) + reg->ctx_offset);
+            }
+            UNIMPL("read16: unimplemented register %s [%x]\n", reg->name, ctx->ip);
+            return 0;
+        }
+    }
+    debug("read16: Unknown addr %x\n", addr);
+    exit(0);
+}
+
+static uint16_t read16(pw_context_t *ctx, uint32_t addr) {
+    ctx->word_access++;
+    addr &= 0xFFFF;
+    const uint8_t *page = ctx->read_pages[addr >> PAGE_SHIFT];
+    if (likely(page != NULL && (addr & PAGE_MASK) != PAGE_MASK)) {
+        ON_CHIP_MEM_ACCESS;
+        return (page[addr & PAGE_MASK] << 8) | page[(addr & PAGE_MASK) + 1];
+    }
+    return read16_slow(ctx, addr);
+}
+
+static uint32_t read24(pw_context_t *ctx, uint32_t addr) {
+    return (read8(ctx, addr) << 16) | (read8(ctx, addr+1) << 8) | read8(ctx, addr+2);
+}
+
+static uint32_t read32(pw_context_t *ctx, uint32_t addr) {
+    return (read16(ctx, addr) << 16) | read16(ctx, addr+2);
+}
+
+static void write8_slow(pw_context_t *ctx, uint16_t addr, uint8_t val) {
+    if (addr >= RAM_start && addr < RAM_end) {
+        ON_CHIP_MEM_ACCESS;
+        ctx->ram[addr - RAM_start] = val;
+        return;
+    } else if ((addr >= IO1_start && addr < IO1_end) || (addr >= IO2_start && addr < IO2_end)) {
+        const mm_reg_t *reg = find_mm_reg(ctx, addr);
+        if (reg && reg->type != REGTYPE_DBW16_ACCS2) {
+            if (reg->write8) {
+                if (reg->type == REGTYPE_DBW8_ACCS2) {
+                    ON_CHIP_MOD8_2_ACCESS;
+                } else {
+                    ON_CHIP_MOD8_3_ACCESS;
+                }
+                reg->write8(((uintptr_t)ctx) + reg->ctx_offset, val);
+            } else {
+                UNIMPL("write8: unimplemented register %s [%x]\n", reg->name, ctx->ip);
+            }
+            return;
+        }
+    }
+    debug("write8: Unknown addr %x\n", addr);
+    exit(0);
+}
+
+static void write8(pw_context_t *ctx, uint16_t addr, uint8_t val) {
+    ctx->byte_access++;
+    uint8_t *page = ctx->write_pages[addr >> PAGE_SHIFT];
+    if (likely(page != NULL)) {
+        ON_CHIP_MEM_ACCESS;
+        page[addr & PAGE_MASK] = val;
+        return;
+    }
+    write8_slow(ctx, addr, val);
+}
+
+static void write16_slow(pw_context_t *ctx, uint16_t addr, uint16_t val) {
+    if (addr >= RAM_start && addr < RAM_end - 1) {
+        ON_CHIP_MEM_ACCESS;
+        ctx->ram[addr - RAM_start] = val >> 8;
+        ctx->ram[addr - RAM_start + 1] = val;
+        return;
+    } else if ((addr >= IO1_start && addr < IO1_end - 1) || (addr >= IO2_start && addr < IO2_end - 1)) {
+        const mm_reg_t *reg = find_mm_reg(ctx, addr);
+        if (reg && reg->type == REGTYPE_DBW16_ACCS2) {
+            if (reg->write16) {
+                ON_CHIP_MOD16_2_ACCESS;
+                reg->write16(((uintptr_t)ctx) + reg->ctx_offset, val);
+            } else {
+                UNIMPL("write16: unimplemented register %s [%x]\n", reg->name, ctx->ip);
+            }
+            return;
+        }
+    }
+    debug("write16: Unknown addr %x\n", addr);
+    exit(0);
+}
+
+static void write16(pw_context_t *ctx, uint16_t addr, uint16_t val) {
+    ctx->word_access++;
+    uint8_t *page = ctx->write_pages[addr >> PAGE_SHIFT];
+    if (likely(page != NULL && (addr & PAGE_MASK) != PAGE_MASK)) {
+        ON_CHIP_MEM_ACCESS;
+        page[addr & PAGE_MASK] = val >> 8;
+        page[(addr & PAGE_MASK) + 1] = val;
+        return;
+    }
+    write16_slow(ctx, addr, val);
+}
+
+static void write32(pw_context_t *ctx, uint16_t addr, uint32_t val) {
+    write16(ctx, addr, val >> 16);
+    write16(ctx, addr+2, val & 0xFFFF);
+}
+
+#ifndef PW_THREADED
+char ccr_names[8] = "CVZNUHUI";
+static void print_state(pw_context_t *ctx) {
+    debug("=== ");
+    for (int i = 0; i < 8; i++) {
+        debug("er%d:%.8x ", i, read_reg32(ctx, i));
+    }
+    debug("[");
+    for (int i = 0; i < 8; i++) {
+        debug(get_ccr_bit(ctx, i) ? "%c" : " ", ccr_names[i]);
+    }
+    debug("] STK:%.8x {B:%d W:%d I:%d}\n", peek32(ctx, read_reg32(ctx, ER_SP)-4), ctx->byte_access, ctx->word_access, ctx->internal_states);
+}
+#endif
+
+// INSNS
+
+static uint8_t rotlb(pw_context_t *ctx, uint8_t val) {
+    uint8_t res = (val << 1) & (val >> 7);
+    set_flags(ctx, FLAGS_ROTL8, val, 0, res);
+    return res;
+}
+
+static uint16_t rotlw(pw_context_t *ctx, uint16_t val) {
+    uint8_t res = (val << 1) & (val >> 15);
+    set_flags(ctx, FLAGS_ROTL16, val, 0, res);
+    return res;
+}
+
+static uint16_t negw(pw_context_t *pw, uint16_t val) {
+    // FIXME
+    return ~val + 1;
+}
+
+static uint8_t negb(pw_context_t *ctx, uint8_t val) {
+    // FIXME
+    return ~val + 1;
+}
+
+// FIXME overflow for arithmetic shifts
+// static uint8_t shalb(uint8_t val) {
+//     uint8_t res = val << 1;
+//     set_ccr_bit(ctx, CCR_N, val >> 7);
+//     set_ccr_bit(ctx, CCR_Z, res == 0);
+//     set_ccr_bit(ctx, CCR_V, 0);
+//     set_ccr_bit(ctx, CCR_C, res >> 7);
+//     return res;
+// }
+
+// static uint16_t shalw(uint16_t val) {
+//     uint16_t res = val << 1;
+//     set_ccr_bit(ctx, CCR_N, val >> 15);
+//     set_ccr_bit(ctx, CCR_Z, res == 0);
+//     set_ccr_bit(ctx, CCR_V, 0);
+//     set_ccr_bit(ctx, CCR_C, res >> 15);
+//     return res;
+// }
+
+// static uint32_t shall(uint32_t val) {
+//     uint32_t res = val << 1;
+//     set_ccr_bit(ctx, CCR_N, val >> 31);
+//     set_ccr_bit(ctx, CCR_Z, res == 0);
+//     set_ccr_bit(ctx, CCR_V, 0);
+//     set_ccr_bit(ctx, CCR_C, res >> 31);
+//     return res;
+// }
+
+// static uint8_t sharb(uint8_t val) {
+//     uint8_t res = (int8_t)val >> 1;
+//     set_ccr_bit(ctx, CCR_N, 0);
+//     set_ccr_bit(ctx, CCR_Z, res == 0);
+//     set_ccr_bit(ctx, CCR_V, 0);
+//     set_ccr_bit(ctx, CCR_C, val & 1U);
+//     return res;
+// }
+
+static uint16_t sharw(pw_context_t *ctx, uint16_t val) {
+    uint16_t res = (int16_t)val >> 1;
+    set_flags(ctx, FLAGS_SHR16, val, 0, res);
+    return res;
+}
+
+static uint32_t sharl(pw_context_t *ctx, uint32_t val) {
+    uint32_t res = (int32_t)val >> 1;
+    set_flags(ctx, FLAGS_SHR32, val, 0, res);
+    return res;
+}
+
+static uint8_t shllb(pw_context_t *ctx, uint8_t val) {
+    uint8_t res = val << 1;
+    set_flags(ctx, FLAGS_SHL8, val, 0, res);
+    return res;
+}
+
+static uint16_t shllw(pw_context_t *ctx, uint16_t val) {
+    uint16_t res = val << 1;
+    set_flags(ctx, FLAGS_SHL16, val, 0, res);
+    return res;
+}
+
+static uint32_t shlll(pw_context_t *ctx, uint32_t val) {
+    uint32_t res = val << 1;
+    set_flags(ctx, FLAGS_SHL32, val, 0, res);
+    return res;
+}
+
+static uint8_t shlrb(pw_context_t *ctx, uint8_t val) {
+    uint8_t res = val >> 1;
+    set_flags(ctx, FLAGS_SHR8, val, 0, res);
+    return res;
+}
+
+static uint16_t shlrw(pw_context_t *ctx, uint16_t val) {
+    uint16_t res = val >> 1;
+    set_flags(ctx, FLAGS_SHR16, val, 0, res);
+    return res;
+}
+
+static uint32_t shlrl(pw_context_t *ctx, uint32_t val) {
+    uint32_t res = val >> 1;
+    set_flags(ctx, FLAGS_SHR32, val, 0, res);
+    return res;
+}
+
+static uint8_t incb(pw_context_t *ctx, uint8_t val) {
+    return val + 1;
+}
+
+static uint8_t bset(pw_context_t *ctx, uint8_t val, int shift) {
+    return val | (1 << shift);
+}
+
+static uint8_t bclr(pw_context_t *ctx, uint8_t val, int shift) {
+    return val & ~(1 << shift);
+}
+
+static uint8_t bst(pw_context_t *ctx, uint8_t val, int shift) {
+    return (val & ~(1 << shift)) | (get_ccr_bit(ctx, CCR_C) << shift);
+}
+
+static uint8_t bnot(pw_context_t *ctx, uint8_t val, int shift) {
+    return val ^ (1 << shift);
+}
+
+static uint8_t movb(pw_context_t *ctx, uint8_t ignore, uint8_t val) {
+    set_flags(ctx, FLAGS_MOV8, 0, 0, val);
+    return val;
+}
+
+static uint16_t movw(pw_context_t *ctx, uint16_t ignore, uint16_t val) {
+    set_flags(ctx, FLAGS_MOV16, 0, 0, val);
+    return val;
+}
+
+static uint32_t movl(pw_context_t *ctx, uint32_t ignore, uint32_t val) {
+    set_flags(ctx, FLAGS_MOV32, 0, 0, val);
+    return val;
+}
+
+static uint8_t notb(pw_context_t *ctx, uint8_t val) {
+    return movb(ctx, 0, ~val);
+}
+
+static uint8_t orb(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    return movb(ctx, 0, a | b);
+}
+
+static uint8_t andb(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    return movb(ctx, 0, a & b);
+}
+
+static uint8_t xorb(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    return movb(ctx, 0, a ^ b);
+}
+
+static uint16_t notw(pw_context_t *ctx, uint16_t val) {
+    return movw(ctx, 0, ~val);
+}
+
+static uint16_t orw(pw_context_t *ctx, uint16_t a, uint16_t b) {
+    return movw(ctx, 0, a | b);
+}
+
+static uint16_t andw(pw_context_t *ctx, uint16_t a, uint16_t b) {
+    return movw(ctx, 0, a & b);
+}
+
+static uint32_t andl(pw_context_t *ctx, uint32_t a, uint32_t b) {
+    return movl(ctx, 0, a & b);
+}
+
+static uint16_t xorw(pw_context_t *ctx, uint16_t a, uint16_t b) {
+    return movw(ctx, 0, a ^ b);
+}
+
+// static uint16_t incw_flags(uint16_t val) {
+//     // FIXME
+//     return val;
+// }
+
+static uint16_t extsw(pw_context_t *pw, uint8_t val) {
+    return sign8_16(val & 0xFF);
+}
+
+static uint32_t extsl(pw_context_t *pw, uint16_t val) {
+    return sign16_32(val & 0xFFFF);
+}
+
+static uint8_t decb_flags(pw_context_t *ctx, uint8_t val) {
+    set_flags(ctx, FLAGS_DEC8, 0, 0, val);
+    return val;
+}
+
+static uint8_t decb(pw_context_t *ctx, uint8_t val) {
+    return decb_flags(ctx, val-1);
+}
+
+static uint16_t decw(pw_context_t *ctx, uint16_t val, uint16_t dec) {
+    uint16_t res = val - dec;
+    set_flags(ctx, FLAGS_DEC16, val, dec, res);
+    return res;
+}
+
+static int branch_condition(pw_context_t *ctx, uint32_t cc) {
+    switch(cc) {
+        case 0: // BRA
+            return 1;
+        case 1: // BRN
+            return 0;
+        case 2: // BHI
+            return !(get_ccr_bit(ctx, CCR_C) || get_ccr_bit(ctx, CCR_Z));
+        case 3: // BLS
+            return get_ccr_bit(ctx, CCR_C) || get_ccr_bit(ctx, CCR_Z);
+        case 4: // BCC
+            return !get_ccr_bit(ctx, CCR_C); 
+        case 5: // BCS
+            return get_ccr_bit(ctx, CCR_C);
+        case 6: // BNE
+            return !get_ccr_bit(ctx, CCR_Z); 
+        case 7: // BEQ
+            return get_ccr_bit(ctx, CCR_Z);
+        case 8: // BVC
+            return !get_ccr_bit(ctx, CCR_V); 
+        case 9: // BVS
+            return get_ccr_bit(ctx, CCR_V);
+        case 0xA: // BPL
+            return !get_ccr_bit(ctx, CCR_N); 
+        case 0xB: // BMI
+            return get_ccr_bit(ctx, CCR_N);
+        case 0xC: // BGE
+            return !(get_ccr_bit(ctx, CCR_N) ^ get_ccr_bit(ctx, CCR_V)); 
+        case 0xD: // BLT
+            return get_ccr_bit(ctx, CCR_N) ^ get_ccr_bit(ctx, CCR_V);        
+        case 0xE: // BGT
+            return !(get_ccr_bit(ctx, CCR_Z) || (get_ccr_bit(ctx, CCR_N) ^ get_ccr_bit(ctx, CCR_V))); 
+        case 0xF: // BLE
+            return get_ccr_bit(ctx, CCR_Z) || (get_ccr_bit(ctx, CCR_N) ^ get_ccr_bit(ctx, CCR_V));
+        default:
+#ifndef _MSC_VER
+    __builtin_unreachable();
+#endif // !_MSC_VER
+            assert(0);
+    }
+}
+
+static void print_cmp(pw_context_t *ctx) {
+    for (int i = 0; i < 16; i++) {
+        debug("%s:%d ", branch_mnemonics[i], branch_condition(ctx, i));
+    }
+    debug("\n");
+}
+
+static uint8_t addx(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    uint8_t val = a + b + get_ccr_bit(ctx, CCR_C);
+    // TODO FLAGS
+    return val;
+}
+
+static uint8_t subx(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    uint8_t val = a - b - get_ccr_bit(ctx, CCR_C);
+    // TODO FLAGS
+    return val;
+}
+
+static uint8_t subb(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    uint8_t val = a - b;
+    //debug("CMP8 %x %d %u, %x %d %u\n", b, (int8_t)b, b, a, (int8_t)a, a);
+    set_flags(ctx, FLAGS_SUB8, a, b, val);
+    print_cmp(ctx);
+    return val;
+}
+
+static uint16_t subw(pw_context_t *ctx, uint16_t a, uint16_t b) {
+    uint16_t val = a - b;
+    //debug("CMP16 %x %d %u, %x %d %u\n", b, (int16_t)b, b, a, (int16_t)a, a);
+    set_flags(ctx, FLAGS_SUB16, a, b, val);
+    print_cmp(ctx);
+    return val;
+}
+
+static uint32_t subl(pw_context_t *ctx, uint32_t a, uint32_t b) {
+    uint32_t val = a - b;
+    //debug("CMP32 %x %d %u, %x %d %u\n", b, (int32_t)b, b, a, (int32_t)a, a);
+    set_flags(ctx, FLAGS_SUB32, a, b, val);
+    print_cmp(ctx);
+    return val;
+}
+
+static uint32_t extu(pw_context_t *ctx, uint32_t val) {
+    // the upper bits are zero, so N is always cleared
+    set_flags(ctx, FLAGS_MOV32, 0, 0, val);
+    return val;
+}
+
+static uint16_t extuw(pw_context_t *ctx, uint16_t val) {
+    return extu(ctx, val & 0xFF);
+}
+
+static uint32_t extul(pw_context_t *ctx, uint16_t val) {
+    return extu(ctx, val & 0xFFFF);
+}
+
+static uint8_t addb(pw_context_t *ctx, uint8_t a, uint8_t b) {
+    // FIXME
+    return a + b;
+}
+
+static uint16_t addw(pw_context_t *ctx, uint16_t a, uint16_t b) {
+    // FIXME
+    return a + b;
+}
+
+static uint32_t addl(pw_context_t *ctx, uint32_t a, uint32_t b) {
+    // FIXME
+    return a + b;
+}
+
+static uint16_t divxub(pw_context_t *ctx, uint16_t a, uint8_t b) {
+    debug("DIVuB %u / %u \n", a, b);
+    set_ccr_bit(ctx, CCR_N, a >> 7);
+    set_ccr_bit(ctx, CCR_Z, b == 0);
+    if (b == 0) {
+        return 0;
+    } else {
+        uint8_t quotient = a / b;
+        uint8_t remainder = a % b;
+        return (remainder << 8) | quotient;
+    }
+}
+
+static uint32_t divxuw(pw_context_t *ctx, uint32_t a, uint16_t b) {
+    debug("DIVuW %u / %u \n", a, b);
+    set_ccr_bit(ctx, CCR_N, a >> 7);
+    set_ccr_bit(ctx, CCR_Z, b == 0);
+    if (b == 0) {
+        return 0;
+    } else {
+        uint16_t quotient = a / b;
+        uint16_t remainder = a % b;
+        return (remainder << 16) | quotient;
+    }
+}
+
+// FIXME
+static uint16_t divxsb(pw_context_t *ctx, uint16_t a, uint8_t b) {
+    int16_t sa = a;
+    int8_t sb = b;
+    debug("DIVB %u / %u \n", sa, sb);
+    set_ccr_bit(ctx, CCR_N, a >> 7);
+    set_ccr_bit(ctx, CCR_Z, b == 0);
+    if (b == 0) {
+        return 0;
+    } else {
+        uint8_t quotient = sa / sb;
+        uint8_t remainder = sa % sb;
+        return (remainder << 8) | quotient;
+    }
+}
+
+// FIXME
+static uint32_t divxsw(pw_context_t *ctx, uint32_t a, uint16_t b) {
+    int32_t sa = a;
+    int16_t sb = b;
+    debug("DIVW %u / %u \n", sa, sb);
+    set_ccr_bit(ctx, CCR_N, a >> 7);
+    set_ccr_bit(ctx, CCR_Z, b == 0);
+    if (b == 0) {
+        return 0;
+    } else {
+        uint16_t quotient = sa / sb;
+        uint16_t remainder = sa % sb;
+        return (remainder << 16) | quotient;
+    }
+}
+
+static uint16_t mulxub(uint16_t a, uint8_t b) {
+    return sign8_16(a) * b;
+}
+
+static uint32_t mulxuw(uint32_t a, uint16_t b) {
+    return sign16_32(a) * b;
+}
+
+static uint16_t mulxsb(uint16_t a, uint8_t b) {
+    return (int16_t)sign8_16(a) * (int8_t)b;
+}
+
+static uint32_t mulxsw(uint32_t a, uint16_t b) {
+    return (int32_t)sign16_32(a) * (int16_t)b;
+}
+
+static void pushl(pw_context_t *ctx, uint32_t val) {
+    uint32_t sp = read_reg32(ctx, ER_SP) - 4;
+    write32(ctx, sp, val);
+    write_reg32(ctx, ER_SP, sp);
+}
+
+static uint32_t popl(pw_context_t *ctx) {
+    uint32_t sp = read_reg32(ctx, ER_SP);
+    write_reg32(ctx, ER_SP, sp + 4);
+    return read32(ctx, sp);
+}
+
+static void pushw(pw_context_t *ctx, uint16_t val) {
+    uint32_t sp = read_reg32(ctx, ER_SP) - 2;
+    write16(ctx, sp, val);
+    write_reg32(ctx, ER_SP, sp);
+}
+
+static uint16_t popw(pw_context_t *ctx) {
+    uint32_t sp = read_reg32(ctx, ER_SP);
+    write_reg32(ctx, ER_SP, sp + 2);
+    return read16(ctx, sp);
+}
+
+#define PUSHIP pushw
+#define POPIP  popw
+
+static void branch(pw_context_t *ctx, uint32_t br_addr, uint32_t ret) {
+    br_addr &= 0xFFFF;
+    debug("BRANCH TO %x\n", br_addr);
+    //switch(br_addr) {
+        // case 0x0822: // irTxByte
+        //     {
+        //         uint8_t byt = read_reg8(ctx, R0L);
+        //         debug("IR TX: %x\n", byt);
+        //         ctx->ip = ret;
+        //         return;
+        //     }
+        // case 0x369C: // is_F7C4_nonzero
+        //     write_reg8(ctx, R0L, 0);
+        //     ctx->ip = ret;
+        //     ctx->word_access++;
+        //     return;
+        // case 0xB924:
+        //     debug("bitfield %x val:%u bits:%u off:%u\n",
+        //         read_reg16(ctx, R0), read_reg8(ctx, R1L), read_reg8(ctx, R2L), read_reg8(ctx, R2H));
+        //     break;
+        // case 0x3832: // likelysetVolume
+        //     debug("LCD volume %x %u\n", ctx->ip, read_reg8(ctx, R0L));
+        //     ctx->ip = ret;
+        //     ctx->word_access++;
+        //     return;
+        //     break;
+        //case 0x76AA: // accelReadSample
+        //case 0xB390: // delaySomewhatAndThenSetTheRtc
+        //case 0x273C: // accelInit
+        // case 0x25AC: // check_some_rtc_set_bit_and_maybe_wait
+            // ctx->ip = ret;
+            // return;
+        // case 0x7998: // normalModeEventLoop
+        //     debug("MAIN EVENT LOOP !\n");
+        //     break;
+        // case 0x7882: // sleepModeEventLoop
+        //     debug("SLEEP EVENT LOOP !\n");
+        //     break;
+        // case 0x289A: // checkBatteryForBelowGivenLevel
+        //     debug("BAT CHECK !\n");
+        //     write_reg8(ctx, R0L, 0);
+        //     ctx->ip = ret;
+        //     ctx->word_access++;
+        //     return;
+        //case 0x7FFC: // someLcdRelatedThing
+            //SDL_Delay(100);
+            //break;
+    //}
+
+    PUSHIP(ctx, ret);
+    ctx->ip = br_addr;
+}
+
+// Every instruction form the interpreter knows, in handler order. Each one
+// gets an op_<name> handler that works from its decode cache entry.
+#define PW_OPS(X) \
+    X(unimpl) X(nop) X(sleep) X(ldc) \
+    X(add_b) X(add_w) X(add_l) X(inc_b) X(adds) X(inc_w) X(inc_l) \
+    X(mov_b) X(mov_w) X(mov_l) X(addx) \
+    X(shll_b) X(shll_w) X(shll_l) X(shlr_b) X(shlr_w) X(shlr_l) X(shar_w) X(shar_l) \
+    X(rotl_b) X(rotl_w) X(or_b) X(xor_b) X(and_b) \
+    X(not_b) X(extu_w) X(extu_l) X(neg_b) X(neg_w) X(exts_w) X(exts_l) \
+    X(sub_b) X(sub_w) X(dec_b) X(sub_l) X(subs) X(dec_w) \
+    X(cmp_b) X(cmp_w) X(subx) X(cmp_l) \
+    X(mov_b_ld_abs8) X(mov_b_st_abs8) X(bcc_8) \
+    X(mulxu_b) X(divxu_b) X(mulxu_w) X(divxu_w) X(rts) X(bsr_8) X(rte) X(bcc_16) \
+    X(jmp_ind) X(jmp_abs) X(jmp_mem) X(bsr_16) X(jsr_ind) X(jsr_abs) X(jsr_mem) \
+    X(bset_r) X(or_w) X(xor_w) X(and_w) X(bst) \
+    X(mov_b_ld_ind) X(mov_b_st_ind) X(mov_w_ld_ind) X(mov_w_st_ind) \
+    X(mov_b_ld_abs16) X(mov_b_st_abs16) X(mov_w_ld_abs16) X(mov_w_ld_abs24) X(mov_w_st_abs16) X(mov_w_st_abs24) \
+    X(mov_b_ld_inc) X(mov_b_st_dec) X(mov_w_ld_inc) X(push_w) \
+    X(mov_b_ld_disp) X(mov_b_st_disp) X(mov_w_ld_disp) X(mov_w_st_disp) \
+    X(bset) X(btst) X(bld) \
+    X(mov_w_imm) X(add_w_imm) X(cmp_w_imm) X(and_w_imm) X(sub_w_imm) X(or_w_imm) \
+    X(add_l_imm) X(cmp_l_imm) X(and_l_imm) X(mov_l_imm) \
+    X(bset_ind) X(bclr_ind) X(bst_ind) X(bnot_ind) \
+    X(band_abs8) X(bld_abs8) X(bset_abs8) X(bclr_abs8) \
+    X(add_b_imm) X(addx_imm) X(cmp_b_imm) X(subx_imm) X(or_b_imm) X(xor_b_imm) X(and_b_imm) X(mov_b_imm) \
+    X(mov_l_ld_ind) X(mov_l_st_ind) X(mov_l_ld_abs16) X(mov_l_st_abs16) X(pop_l) X(push_l) \
+    X(mov_l_ld_disp) X(mov_l_st_disp) X(mulxs_b) X(mulxs_w) X(divxs_b) X(divxs_w)
+
+#define OP_ENUM(name) OP_##name,
+enum pw_op {
+    PW_OPS(OP_ENUM)
+    NUM_OPS
+};
+
+#define MAJ      ( instr >> 8)
+#define MAJ_H    ( instr >> 12)
+#define MAJ_L    ((instr >> 8) & 0xF)
+#define MIN      ( instr       & 0xFF)
+#define MIN_H    ((instr >> 4) & 0xF)
+#define MIN_L    ( instr       & 0xF)
+#define MIN_HMSB ((instr >> 7) & 1)
+#define MIN_HCHK ((instr >> 4) & 7)
+#define MIN_LMSB ((instr >> 3) & 1)
+#define MIN_LCHK ( instr       & 7)
+#define THR_FUR   instr3_4
+#define THR      (instr3_4 >> 8)
+#define THR_H    (instr3_4 >> 12)
+#define THR_L    ((instr3_4 >> 8) & 0xF)
+#define FUR      ( instr3_4       & 0xFF)
+#define FUR_H    ((instr3_4 >> 4) & 0xF)
+#define FUR_L    (instr3_4 & 0xF)
+#define FUR_HMSB ((instr3_4 >> 7) & 1)
+#define FUR_HCHK ((instr3_4 >> 4) & 7)
+#define FUR_LMSB ((instr3_4 >> 3) & 1)
+#define FUR_LCHK ( instr3_4       & 7)
+
+// Operand words come with the opcode, their bus accounting is the same as
+// for a read16 from ROM and happens before anything else the instruction
+// does
+#define FETCH_OPERANDS ctx->word_access += d->fetches; ctx->states += 2 * d->fetches;
+
+#define NOOP(mmn) debug(mmn"\n"); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+
+#define OP_R8_R8(mmn, f) debug(mmn " r%d, r%d\n", d->rs, d->rd); write_reg8(ctx, d->rd, f(ctx, read_reg8(ctx, d->rd), read_reg8(ctx, d->rs))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_R8(mmn, f) debug(mmn " r%d\n", d->rd); write_reg8(ctx, d->rd, f(ctx, read_reg8(ctx, d->rd))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_IMM8_R8(mmn, f) debug(mmn " #%x:8, r%d\n", d->imm, d->rd); write_reg8(ctx, d->rd, f(ctx, read_reg8(ctx, d->rd), d->imm)); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_IMM3_ABS8(mmn, f) FETCH_OPERANDS; debug(mmn " #%x, @%x:8\n", d->rs, d->imm); write8(ctx, d->imm, f(ctx, read8(ctx, d->imm), d->rs)); ctx->ip += 4; STATES(2, 0, 0, 2, 0, 0);
+#define OP_IMM3_REG8(mmn, f) debug(mmn " #%x, r%d\n", d->rs, d->rd); write_reg8(ctx, d->rd, f(ctx, read_reg8(ctx, d->rd), d->rs)); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_IMM3_REGI8(mmn, f) FETCH_OPERANDS; { debug(mmn " #%x:3, @er%d\n", d->rs, d->rd); uint32_t erd_addr = read_reg32(ctx, d->rd); write8(ctx, erd_addr, f(ctx, read8(ctx, erd_addr), d->rs)); ctx->ip += 4; STATES(2, 0, 0, 2, 0, 0); }
+
+#define OP_R16_R16(mmn, f) debug(mmn " r%d, r%d\n", d->rs, d->rd); write_reg16(ctx, d->rd, f(ctx, read_reg16(ctx, d->rd), read_reg16(ctx, d->rs))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_R16(mmn, f) debug(mmn " r%d\n", d->rd); write_reg16(ctx, d->rd, f(ctx, read_reg16(ctx, d->rd))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_IMM16_R16(mmn, f) FETCH_OPERANDS; debug(mmn " #%x:16, r%d\n", d->imm, d->rd); write_reg16(ctx, d->rd, f(ctx, read_reg16(ctx, d->rd), d->imm)); ctx->ip += 4; STATES(2, 0, 0, 0, 0, 0);
+
+#define OP_R32_R32(mmn, f) debug(mmn " er%d, er%d\n", d->rs, d->rd); write_reg32(ctx, d->rd, f(ctx, read_reg32(ctx, d->rd), read_reg32(ctx, d->rs))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_R32(mmn, f) debug(mmn  " er%d\n", d->rd); write_reg32(ctx, d->rd, f(ctx, read_reg32(ctx, d->rd))); ctx->ip += 2; STATES(1, 0, 0, 0, 0, 0);
+#define OP_IMM32_R32(mmn, f) FETCH_OPERANDS; debug(mmn  " #%x:32, ER%d\n", d->imm, d->rd); write_reg32(ctx, d->rd, f(ctx, read_reg32(ctx, d->rd), d->imm)); ctx->ip += 6; STATES(3, 0, 0, 0, 0, 0);
+
+static void op_unimpl(pw_context_t *ctx, const pw_decoded_t *d) {
+    // the ip doesn't move, so the run stops here. imm holds the internal
+    // states the instruction still spends.
+    FETCH_OPERANDS;
+    debug("unimplemented %.4x\n", d->instr);
+    INTERNAL_STATES(d->imm);
+}
+
+static void op_nop(pw_context_t *ctx, const pw_decoded_t *d) {
+    // NOP
+    NOOP("nop");
+}
+
+static void op_sleep(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SLEEP
+    sleep_transition(ctx);
+    NOOP("sleep");
+}
+
+static void op_ldc(pw_context_t *ctx, const pw_decoded_t *d) {
+    // LDC #xx:8,CCR
+    debug("ldc #%x:8, CCR\n", d->imm);
+    set_ccr(ctx, d->imm);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_add_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.B Rs,Rd
+    OP_R8_R8("add.b", addb);
+}
+
+static void op_add_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.W Rs,Rd
+    OP_R16_R16("add.w", addw);
+}
+
+static void op_add_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.L ERs,ERd
+    OP_R32_R32("add.l", addl);
+}
+
+static void op_inc_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // INC.B Rd
+    OP_R8("inc.b", incb);
+}
+
+static void op_adds(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADDS #1/2/4,ERd
+    debug("adds #%d, er%d\n", d->imm, d->rd);
+    write_reg32(ctx, d->rd, read_reg32(ctx, d->rd) + d->imm);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_inc_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // INC.W #1/2,Rd
+    debug("inc.w #%d, r%d\n", d->imm, d->rd);
+    write_reg16(ctx, d->rd, read_reg16(ctx, d->rd) + d->imm);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_inc_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // INC.L #1,ERd
+    debug("inc.l #1, er%d\n", d->rd);
+    write_reg32(ctx, d->rd, read_reg32(ctx, d->rd) + 1);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_mov_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,Rd
+    OP_R8_R8("mov.b", movb);
+}
+
+static void op_mov_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W Rs,Rd
+    OP_R16_R16("mov.w", movw);
+}
+
+static void op_mov_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L ERs,ERd
+    OP_R32_R32("mov.l", movl);
+}
+
+static void op_addx(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADDX Rs,Rd
+    OP_R8_R8("addx", addx);
+}
+
+static void op_shll_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLL.B Rd
+    OP_R8("shll.b", shllb);
+}
+
+static void op_shll_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLL.W Rd
+    OP_R16("shll.w", shllw);
+}
+
+static void op_shll_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLL.L ERd
+    OP_R32("shll.l", shlll);
+}
+
+static void op_shlr_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLR.B Rd
+    OP_R8("shlr.b", shlrb);
+}
+
+static void op_shlr_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLR.W Rd
+    OP_R16("shlr.w", shlrw);
+}
+
+static void op_shlr_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHLR.L ERd
+    OP_R32("shlr.l", shlrl);
+}
+
+static void op_shar_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHAR.W Rd
+    OP_R16("shar.w", sharw);
+}
+
+static void op_shar_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SHAR.L ERd
+    OP_R32("shar.l", sharl);
+}
+
+static void op_rotl_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ROTL.B Rd
+    OP_R8("rotl.b", rotlb);
+}
+
+static void op_rotl_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ROTL.W Rd
+    OP_R16("rotl.w", rotlw);
+}
+
+static void op_or_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // OR.B Rs,Rd
+    OP_R8_R8("or.b", orb);
+}
+
+static void op_xor_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // XOR.B Rs,Rd
+    OP_R8_R8("xor.b", xorb);
+}
+
+static void op_and_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // AND.B Rs,Rd
+    OP_R8_R8("and.b", andb);
+}
+
+static void op_not_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // NOT.B Rd
+    OP_R8("not.b", notb);
+}
+
+static void op_extu_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // EXTU.W Rd
+    OP_R16("extu.w", extuw);
+}
+
+static void op_extu_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // EXTU.L ERd
+    OP_R32("extu.l", extul);
+}
+
+static void op_neg_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // NEG.B Rd
+    OP_R8("neg.b", negb);
+}
+
+static void op_neg_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // NEG.W Rd
+    OP_R16("neg.w", negw);
+}
+
+static void op_exts_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // EXTS.W Rd
+    OP_R16("exts.w", extsw);
+}
+
+static void op_exts_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // EXTS.L ERd
+    OP_R32("exts.l", extsl);
+}
+
+static void op_sub_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUB.B Rs,Rd
+    OP_R8_R8("sub.b", subb);
+}
+
+static void op_sub_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUB.W Rs,Rd
+    OP_R16_R16("sub.w", subw);
+}
+
+static void op_dec_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DEC.B Rd
+    OP_R8("dec.b", decb);
+}
+
+static void op_sub_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUB.L ERs,ERd
+    OP_R32_R32("sub.l", subl);
+}
+
+static void op_subs(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUBS #1/2/4,ERd
+    debug("subs #%d, er%d\n", d->imm, d->rd);
+    write_reg32(ctx, d->rd, read_reg32(ctx, d->rd) - d->imm);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_dec_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DEC.W #1,Rd
+    debug("dec.w #1, r%d\n", d->rd);
+    write_reg16(ctx, d->rd, decw(ctx, read_reg16(ctx, d->rd), 1));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_cmp_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.B Rs,Rd
+    debug("cmp.b r%d, r%d\n", d->rs, d->rd);
+    subb(ctx, read_reg8(ctx, d->rd), read_reg8(ctx, d->rs));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_cmp_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.W Rs,Rd
+    debug("cmp.w r%d, r%d\n", d->rs, d->rd);
+    subw(ctx, read_reg16(ctx, d->rd), read_reg16(ctx, d->rs));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_subx(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUBX Rs,Rd
+    OP_R8_R8("subx", subx);
+}
+
+static void op_cmp_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.L ERs,ERd
+    debug("cmp.l er%d, er%d\n", d->rs, d->rd);
+    subl(ctx, read_reg32(ctx, d->rd), read_reg32(ctx, d->rs));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_mov_b_ld_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B @aa:8,Rd
+    debug("mov.b @%x:8, r%d\n", d->imm, d->rd);
+    write_reg8(ctx, d->rd, movb(ctx, 0, read8(ctx, d->imm)));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_b_st_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,@aa:8
+    debug("mov.b r%d, @%x:8\n", d->rs, d->imm);
+    write8(ctx, d->imm, movb(ctx, 0, read_reg8(ctx, d->rs)));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 0);
+}
+
+static void op_bcc_8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // Bxx d:8
+    uint32_t target = d->imm;
+    if (target > 0x3838 && target < 0x388A) {
+    printf("%s %x %d\n", branch_mnemonics[d->rs], target, branch_condition(ctx, d->rs));
+    }
+    if (branch_condition(ctx, d->rs)) {
+        read16(ctx, ctx->ip + 2);
+        ctx->ip = target;
+    } else {
+        read16(ctx, target);
+        ctx->ip += 2;
+    }
+    STATES(2, 0, 0, 0, 0, 0);
+}
+
+static void op_mulxu_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MULXU.B Rs,Rd
+    debug("mulxu.b r%d r%d\n", d->rs, d->rd);
+    write_reg16(ctx, d->rd, mulxub(read_reg16(ctx, d->rd), read_reg8(ctx, d->rs)));
+    INTERNAL_STATES(12);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 12);
+}
+
+static void op_divxu_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DIVXU.B Rs,Rd
+    debug("divxu.b r%d, r%d\n", d->rs, d->rd);
+    write_reg16(ctx, d->rd, divxub(ctx, read_reg16(ctx, d->rd), read_reg8(ctx, d->rs)));
+    INTERNAL_STATES(12);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 12);
+}
+
+static void op_mulxu_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MULXU.W Rs,ERd
+    debug("mulxu.w r%d, er%d\n", d->rs, d->rd);
+    write_reg32(ctx, d->rd, mulxuw(read_reg32(ctx, d->rd), read_reg16(ctx, d->rs)));
+    INTERNAL_STATES(20);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 20);
+}
+
+static void op_divxu_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DIVXU.W Rs,ERd
+    debug("divxu.w r%d, er%d\n", d->rs, d->rd);
+    write_reg32(ctx, d->rd, divxuw(ctx, read_reg32(ctx, d->rd), read_reg16(ctx, d->rs)));
+    INTERNAL_STATES(20);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 20);
+}
+
+static void op_rts(pw_context_t *ctx, const pw_decoded_t *d) {
+    // RTS
+    debug("rts\n");
+    read16(ctx, ctx->ip + 2);
+    INTERNAL_STATES(2);
+    ctx->ip = POPIP(ctx);
+    STATES(2, 0, 1, 0, 0, 2);
+}
+
+static void op_bsr_8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSR d:8
+    uint32_t next = ctx->ip + 2;
+    debug("bsr %x:8\n", d->imm);
+    branch(ctx, d->imm, next);
+    read16(ctx, next);
+    STATES(2, 0, 1, 0, 0, 0);
+}
+
+static void op_rte(pw_context_t *ctx, const pw_decoded_t *d) {
+    // RTE
+    debug("rte\n");
+    // TODO: check if this is right
+    read16(ctx, ctx->ip + 2);
+    INTERNAL_STATES(2);
+    set_ccr(ctx, popw(ctx));
+    ctx->ip = POPIP(ctx);
+    tmrw_sync(ctx);
+    ctx->int_enabled = 1;
+    tmrw_schedule(ctx);
+    irq_update(ctx);
+    STATES(2, 0, 2, 0, 0, 2);
+}
+
+static void op_bcc_16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // Bxx d:16
+    FETCH_OPERANDS;
+    debug("%s %x\n", branch_mnemonics[d->rs], d->imm);
+    INTERNAL_STATES(2);
+    if (branch_condition(ctx, d->rs)) {
+        ctx->ip = d->imm;
+    } else {
+        ctx->ip += 4;
+    }
+    STATES(2, 0, 0, 0, 0, 2);
+}
+
+static void op_jmp_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JMP @ERn
+    debug("jmp @er%d\n", d->rs);
+    read16(ctx, ctx->ip+2);
+    ctx->ip = read_reg32(ctx, d->rs);
+    STATES(2, 0, 0, 0, 0, 0);
+}
+
+static void op_jmp_abs(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JMP @aa:24
+    FETCH_OPERANDS;
+    debug("jmp @%x\n", d->imm);
+    INTERNAL_STATES(2);
+    ctx->ip = d->imm;
+    STATES(2, 0, 0, 0, 0, 2);
+}
+
+static void op_jmp_mem(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JMP @@aa:8, not implemented
+    debug("jmp @@%x:8\n", d->imm);
+    INTERNAL_STATES(2);
+    STATES(2, 1, 0, 0, 0, 2);
+}
+
+static void op_bsr_16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSR d:16
+    FETCH_OPERANDS;
+    debug("bsr %x:16\n", d->imm);
+    INTERNAL_STATES(2);
+    branch(ctx, d->imm, ctx->ip+4);
+    STATES(2, 0, 1, 0, 0, 2);
+}
+
+static void op_jsr_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JSR @ERn
+    debug("jsr @er%d\n", d->rs);
+    read16(ctx, ctx->ip+2);
+    branch(ctx, read_reg32(ctx, d->rs), ctx->ip+2);
+    STATES(2, 0, 1, 0, 0, 0);
+}
+
+static void op_jsr_abs(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JSR @aa:24
+    FETCH_OPERANDS;
+    debug("jsr @%x:24\n", d->imm);
+    INTERNAL_STATES(2);
+    branch(ctx, d->imm, ctx->ip+4);
+    STATES(2, 0, 1, 0, 0, 2);
+}
+
+static void op_jsr_mem(pw_context_t *ctx, const pw_decoded_t *d) {
+    // JSR @@aa:8, not implemented
+    debug("jsr @@%x:8\n", d->imm);
+    STATES(2, 1, 1, 0, 0, 0);
+}
+
+static void op_bset_r(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSET Rn,Rd
+    debug("bset r%d, r%d\n", d->rs, d->rd);
+    write_reg8(ctx, d->rd, read_reg8(ctx, d->rd) | (1 << (read_reg8(ctx, d->rs) & 7)));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_or_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // OR.W Rs,Rd
+    OP_R16_R16("or.w", orw);
+}
+
+static void op_xor_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // XOR.W Rs,Rd
+    OP_R16_R16("xor.w", xorw);
+}
+
+static void op_and_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // AND.W Rs,Rd
+    OP_R16_R16("and.w", andw);
+}
+
+static void op_bst(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BST #xx:3,Rd
+    OP_IMM3_REG8("bst", bst);
+}
+
+static void op_mov_b_ld_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B @ERs,Rd
+    debug("mov.b @er%d, r%d\n", d->rs, d->rd);
+    write_reg8(ctx, d->rd, movb(ctx, 0, read8(ctx, read_reg32(ctx, d->rs))));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_b_st_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,@ERd
+    debug("mov.b r%d, @er%d\n", d->rs, d->rd);
+    write8(ctx, read_reg32(ctx, d->rd), movb(ctx, 0, read_reg8(ctx, d->rs)));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_w_ld_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W @ERs,Rd
+    debug("mov.w @er%d, r%d\n", d->rs, d->rd);
+    write_reg16(ctx, d->rd, movw(ctx, 0, read16(ctx, read_reg32(ctx, d->rs))));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_w_st_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W Rs,@ERd
+    debug("mov.w r%d, @er%d\n", d->rs, d->rd);
+    write16(ctx, read_reg32(ctx, d->rd), movw(ctx, 0, read_reg16(ctx, d->rs)));
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_b_ld_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B @aa:16,Rd
+    FETCH_OPERANDS;
+    debug("mov.b @%x:16, r%d\n", d->imm, d->rd);
+    write_reg8(ctx, d->rd, movb(ctx, 0, read8(ctx, d->imm)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_b_st_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,@aa:16
+    FETCH_OPERANDS;
+    debug("mov.b r%d, @%x:16\n", d->rs, d->imm);
+    write8(ctx, d->imm, movb(ctx, 0, read_reg8(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_w_ld_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W @aa:16,Rd
+    FETCH_OPERANDS;
+    debug("mov.w @%x:16, r%d\n", d->imm, d->rd);
+    write_reg16(ctx, d->rd, movw(ctx, 0, read16(ctx, d->imm)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_w_st_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W Rs,@aa:16
+    FETCH_OPERANDS;
+    debug("mov.w r%d, @%x:16\n", d->rs, d->imm);
+    write16(ctx, d->imm, movw(ctx, 0, read_reg16(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_w_ld_abs24(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W @aa:24,Rd, loads the address itself. It has always gone on
+    // into the @aa:16 store to its first operand word, which is below
+    // 0x100 and stops the emulator as a write to the ROM.
+    FETCH_OPERANDS;
+    debug("mov.w @%x:24, r%d\n", ABS24(peek24(ctx, ctx->ip+3)), d->rs);
+    write_reg16(ctx, d->rs, movw(ctx, 0, ABS24(read24(ctx, ctx->ip+3))));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 1, 0);
+    debug("mov.w r%d, @%x:16\n", d->rs, d->imm);
+    write16(ctx, d->imm, movw(ctx, 0, read_reg16(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_w_st_abs24(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W Rs,@aa:24
+    FETCH_OPERANDS;
+    debug("mov.w r%d, @%x:24\n", d->rs, peek24(ctx, ctx->ip+3));
+    write16(ctx, ABS24(read24(ctx, ctx->ip+3)), movw(ctx, 0, read_reg16(ctx, d->rs)));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_b_ld_inc(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B @ERs+,Rd
+    debug("mov.b @er%d+, r%d\n", d->rs, d->rd);
+    uint32_t indir_addr = read_reg32(ctx, d->rs);
+    write_reg8(ctx, d->rd, movb(ctx, 0, read8(ctx, indir_addr)));
+    write_reg32(ctx, d->rs, indir_addr+1);
+    INTERNAL_STATES(2);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 2);
+}
+
+static void op_mov_b_st_dec(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,@-ERd
+    debug("mov.b r%d, @-er%d\n", d->rs, d->rd);
+    uint32_t indir_addr = read_reg32(ctx, d->rd) - 1;
+    write8(ctx, indir_addr, movb(ctx, 0, read_reg8(ctx, d->rs)));
+    write_reg32(ctx, d->rd, indir_addr);
+    INTERNAL_STATES(2);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 1, 0, 2);
+}
+
+static void op_mov_w_ld_inc(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W @ERs+,Rd
+    debug("mov.w @er%d+, r%d\n", d->rs, d->rd);
+    uint16_t ers = read_reg32(ctx, d->rs);
+    write_reg16(ctx, d->rd, movw(ctx, 0, read16(ctx, ers)));
+    write_reg16(ctx, d->rs, ers+2);
+    INTERNAL_STATES(2);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 1, 2);
+}
+
+static void op_push_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // PUSH.W Rn
+    debug("push.w r%d\n", d->rs);
+    pushw(ctx, movw(ctx, 0, read_reg16(ctx, d->rs)));
+    INTERNAL_STATES(2);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 1, 2);
+}
+
+static void op_mov_b_ld_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B @(d:16,ERs),Rd
+    FETCH_OPERANDS;
+    debug("mov.b @(%x,er%d), r%d\n", d->imm, d->rs, d->rd);
+    write_reg8(ctx, d->rd, movb(ctx, 0, read8(ctx, read_reg32(ctx, d->rs) + d->imm)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_b_st_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B Rs,@(d:16,ERd)
+    FETCH_OPERANDS;
+    debug("mov.b r%d, @(%x,er%d)\n", d->rs, d->imm, d->rd);
+    write8(ctx, read_reg32(ctx, d->rd) + d->imm, movb(ctx, 0, read_reg8(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_mov_w_ld_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W @(d:16,ERs),Rd
+    FETCH_OPERANDS;
+    debug("mov.w @(%x, er%d), r%d\n", d->imm, d->rs, d->rd);
+    write_reg16(ctx, d->rd, movw(ctx, 0, read16(ctx, read_reg32(ctx, d->rs) + d->imm)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 1, 0);
+}
+
+static void op_mov_w_st_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W Rs,@(d:16,ERd)
+    FETCH_OPERANDS;
+    debug("mov.w r%d, @(%x, er%d)\n", d->rs, d->imm, d->rd);
+    write16(ctx, read_reg32(ctx, d->rd) + d->imm, movw(ctx, 0, read_reg16(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 1, 0);
+}
+
+static void op_bset(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSET #xx:3,Rd
+    OP_IMM3_REG8("bset", bset);
+}
+
+static void op_btst(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BTST #xx:3,Rd
+    debug("btst #%x, r%d\n", d->rs, d->rd);
+    set_ccr_bit(ctx, CCR_Z, ~(read_reg8(ctx, d->rd) >> d->rs) & 1UL);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_bld(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BLD #xx:3,Rd
+    debug("bld #%x:3, r%d\n", d->rs, d->rd);
+    set_ccr_bit(ctx, CCR_C, (read_reg8(ctx, d->rd) >> d->rs) & 1);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_mov_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.W #xx:16,Rd
+    OP_IMM16_R16("mov.w", movw);
+}
+
+static void op_add_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.W #xx:16,Rd
+    OP_IMM16_R16("add.w", addw);
+}
+
+static void op_cmp_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.W #xx:16,Rd
+    FETCH_OPERANDS;
+    debug("cmp.w #%x:16, r%d\n", d->imm, d->rd);
+    subw(ctx, read_reg16(ctx, d->rd), d->imm);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 0, 0);
+}
+
+static void op_and_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // AND.W #xx:16,Rd
+    OP_IMM16_R16("and.w", andw);
+}
+
+static void op_sub_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUB.W #xx:16,Rd
+    OP_IMM16_R16("sub.w", subw);
+}
+
+static void op_or_w_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // OR.W #xx:16,Rd
+    OP_IMM16_R16("or.w", orw);
+}
+
+static void op_add_l_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.L #xx:32,ERd
+    OP_IMM32_R32("add.l", addl);
+}
+
+static void op_cmp_l_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.L #xx:32,ERd
+    FETCH_OPERANDS;
+    debug("cmp.l #%x:32, ER%d\n", d->imm, d->rd);
+    subl(ctx, read_reg32(ctx, d->rd), d->imm);
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 0, 0);
+}
+
+static void op_and_l_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // AND.L #xx:32,ERd
+    OP_IMM32_R32("and.l", andl);
+}
+
+static void op_mov_l_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L #xx:32,Rd
+    OP_IMM32_R32("mov.l", movl);
+}
+
+static void op_bset_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSET #xx:3,@ERd
+    OP_IMM3_REGI8("bset", bset);
+}
+
+static void op_bclr_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BCLR #xx:3,@ERd
+    OP_IMM3_REGI8("bclr", bclr);
+}
+
+static void op_bst_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BST #xx:3,@ERd
+    OP_IMM3_REGI8("bst", bst);
+}
+
+static void op_bnot_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BNOT #xx:3,@ERd
+    OP_IMM3_REGI8("bnot", bnot);
+}
+
+static void op_band_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BAND #xx:3,@aa:8
+    FETCH_OPERANDS;
+    debug("band #%x:3, @%x:8\n", d->rs, d->imm);
+    set_ccr_bit(ctx, CCR_C, ((read8(ctx, d->imm) >> d->rs) & 1) & get_ccr_bit(ctx, CCR_C));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_bld_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BLD #xx:3,@aa:8
+    FETCH_OPERANDS;
+    debug("bld #%x:3, @%x:8\n", d->rs, d->imm);
+    set_ccr_bit(ctx, CCR_C, (read8(ctx, d->imm) >> d->rs) & 1);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 1, 0, 0);
+}
+
+static void op_bset_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BSET #xx:3,@aa:8
+    OP_IMM3_ABS8("bset", bset);
+}
+
+static void op_bclr_abs8(pw_context_t *ctx, const pw_decoded_t *d) {
+    // BCLR #xx:3,@aa:8
+    OP_IMM3_ABS8("bclr", bclr);
+}
+
+static void op_add_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADD.B #xx:8,Rd
+    OP_IMM8_R8("add.b", addb);
+}
+
+static void op_addx_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // ADDX #xx:8,Rd
+    OP_IMM8_R8("addx", addx);
+}
+
+static void op_cmp_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // CMP.B #xx:8,Rd
+    debug("cmp.b #%x:8, r%d\n", d->imm, d->rd);
+    subb(ctx, read_reg8(ctx, d->rd), d->imm);
+    ctx->ip += 2;
+    STATES(1, 0, 0, 0, 0, 0);
+}
+
+static void op_subx_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // SUBX #xx:8,Rd
+    OP_IMM8_R8("subx", subx);
+}
+
+static void op_or_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // OR.B #xx:8,Rd
+    OP_IMM8_R8("or.b", orb);
+}
+
+static void op_xor_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // XOR.B #xx:8,Rd
+    OP_IMM8_R8("xor.b", xorb);
+}
+
+static void op_and_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // AND.B #xx:8,Rd
+    OP_IMM8_R8("and.b", andb);
+}
+
+static void op_mov_b_imm(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.B #xx:8,Rd
+    OP_IMM8_R8("mov.b", movb);
+}
+
+static void op_mov_l_ld_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L @ERs,ERd
+    FETCH_OPERANDS;
+    debug("mov.l @er%d, er%d\n", d->rs, d->rd);
+    write_reg32(ctx, d->rd, movl(ctx, 0, read32(ctx, read_reg32(ctx, d->rs))));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 2, 0);
+}
+
+static void op_mov_l_st_ind(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L ERs,@ERd
+    FETCH_OPERANDS;
+    debug("mov.l er%d, @er%d\n", d->rs, d->rd);
+    write32(ctx, read_reg32(ctx, d->rd), movl(ctx, 0, read_reg32(ctx, d->rs)));
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 2, 0);
+}
+
+static void op_mov_l_ld_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L @aa:16,ERd
+    FETCH_OPERANDS;
+    debug("mov.l @%x:16, er%d\n", d->imm, d->rd);
+    write_reg32(ctx, d->rd, movl(ctx, 0, read32(ctx, d->imm)));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 2, 0);
+}
+
+static void op_mov_l_st_abs16(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L ERs,@aa:16
+    FETCH_OPERANDS;
+    debug("mov.l er%d, @%x:16\n", d->rs, d->imm);
+    write32(ctx, d->imm, movl(ctx, 0, read_reg32(ctx, d->rs)));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 2, 0);
+}
+
+static void op_pop_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // POP.L ERn
+    FETCH_OPERANDS;
+    debug("pop.l er%d\n", d->rd);
+    write_reg32(ctx, d->rd, popl(ctx));
+    INTERNAL_STATES(2);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 2, 2);
+}
+
+static void op_push_l(pw_context_t *ctx, const pw_decoded_t *d) {
+    // PUSH.L ERn
+    FETCH_OPERANDS;
+    debug("push.l er%d\n", d->rs);
+    pushl(ctx, read_reg32(ctx, d->rs));
+    INTERNAL_STATES(2);
+    ctx->ip += 4;
+    // Documentation is wrong about the cycles for this instruction
+    // Spec says 1 instruction fetch cycle but there are actually 2
+    STATES(2, 0, 0, 0, 2, 2);
+}
+
+static void op_mov_l_ld_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L @(d:16,ERs),ERd
+    FETCH_OPERANDS;
+    debug("mov.l @(%x, er%d), er%d\n", d->imm, d->rs, d->rd);
+    write_reg32(ctx, d->rd, read32(ctx, movl(ctx, 0, read_reg32(ctx, d->rs) + d->imm)));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 2, 0);
+}
+
+static void op_mov_l_st_disp(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MOV.L ERs,@(d:16,ERd)
+    FETCH_OPERANDS;
+    debug("mov.l er%d, @(%x, er%d)\n", d->rs, d->imm, d->rd);
+    write32(ctx, read_reg32(ctx, d->rd) + d->imm, movl(ctx, 0, read_reg32(ctx, d->rs)));
+    ctx->ip += 6;
+    STATES(3, 0, 0, 0, 2, 0);
+}
+
+static void op_mulxs_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MULXS.B Rs,Rd
+    FETCH_OPERANDS;
+    debug("mulxs.b r%d, r%d\n", d->rs, d->rd);
+    write_reg16(ctx, d->rd, mulxsb(read_reg16(ctx, d->rd), read_reg8(ctx, d->rs)));
+    INTERNAL_STATES(12);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 0, 12);
+}
+
+static void op_mulxs_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // MULXS.W Rs,ERd
+    FETCH_OPERANDS;
+    debug("mulxs.w r%d, er%d\n", d->rs, d->rd);
+    write_reg32(ctx, d->rd, mulxsw(read_reg32(ctx, d->rd), read_reg16(ctx, d->rs)));
+    INTERNAL_STATES(20);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 0, 20);
+}
+
+static void op_divxs_b(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DIVXS.B Rs,Rd
+    FETCH_OPERANDS;
+    debug("divxs.b r%d, r%d\n", d->rs, d->rd);
+    write_reg16(ctx, d->rd, divxsb(ctx, read_reg16(ctx, d->rd), read_reg8(ctx, d->rs)));
+    INTERNAL_STATES(12);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 0, 12);
+}
+
+static void op_divxs_w(pw_context_t *ctx, const pw_decoded_t *d) {
+    // DIVXS.W Rs,ERd
+    FETCH_OPERANDS;
+    debug("divxs.w r%d, er%d\n", d->rs, d->rd);
+    write_reg32(ctx, d->rd, divxsw(ctx, read_reg32(ctx, d->rd), read_reg16(ctx, d->rs)));
+    INTERNAL_STATES(20);
+    ctx->ip += 4;
+    STATES(2, 0, 0, 0, 0, 20);
+}
+
+typedef void (*op_handler)(pw_context_t *ctx, const pw_decoded_t *d);
+
+#define OP_HANDLER(name) op_##name,
+static const op_handler op_handlers[NUM_OPS] = {
+    PW_OPS(OP_HANDLER)
+};
+
+// Decoding
+
+// Fills in an entry for the given handler. The instruction is the opcode
+// plus its operand words, callers fix up len where that's not the case.
+static void decoded(pw_decoded_t *d, enum pw_op op, int fetches, int rs, int rd, uint32_t imm) {
+    d->handler = op_handlers[op];
+    d->op      = op;
+    d->len     = 2 + 2 * fetches;
+    d->fetches = fetches;
+    d->rs      = rs;
+    d->rd      = rd;
+    d->imm     = imm;
+}
+
+// Decoders pick the handler for an opcode and take its fields apart. They
+// get the instruction's address, the opcode and the two words after it,
+// which the macros know as instr and instr3_4. Forms they don't recognise
+// keep the unimplemented entry decode starts out with.
+typedef void (*instr_decoder)(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1);
+
+static void dec_00(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN == 0) {
+        decoded(d, OP_nop, 0, 0, 0, 0);
+    }
+}
+
+static void dec_01(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN == 0x00) {
+        decoded(d, OP_unimpl, 1, 0, 0, 0);
+        switch (THR) {
+            case 0x69:
+                if (FUR_HMSB == 0 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_ld_ind, 1, FUR_HCHK, FUR_LCHK, 0);
+                } else if (FUR_HMSB == 1 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_st_ind, 1, FUR_LCHK, FUR_HCHK, 0);
+                }
+                break;
+            case 0x6B:
+                // MOV.L with @aa:24 isn't implemented
+                if (FUR_H == 0 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_ld_abs16, 2, 0, FUR_LCHK, ABS16(ext1));
+                } else if (FUR_H == 8 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_st_abs16, 2, FUR_LCHK, 0, ABS16(ext1));
+                }
+                break;
+            case 0x6D:
+                if (FUR_HMSB == 0 && FUR_LMSB == 0) {
+                    if (FUR_H == 7) {
+                        decoded(d, OP_pop_l, 1, 0, FUR_LCHK, 0);
+                    } else {
+                        // MOV.L @ERs+,ERd isn't implemented
+                        decoded(d, OP_unimpl, 1, 0, 0, 2);
+                    }
+                } else if (FUR_HMSB == 1 && FUR_LMSB == 0) {
+                    if (FUR_H == 0xF) {
+                        decoded(d, OP_push_l, 1, FUR_LCHK, 0, 0);
+                    } else {
+                        // MOV.L ERs,@-ERd isn't implemented
+                        decoded(d, OP_unimpl, 1, 0, 0, 2);
+                    }
+                }
+                break;
+            case 0x6F:
+                // the displacement of the load isn't sign extended
+                if (FUR_HMSB == 0 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_ld_disp, 2, FUR_HCHK, FUR_LCHK, ext1);
+                } else if (FUR_HMSB == 1 && FUR_LMSB == 0) {
+                    decoded(d, OP_mov_l_st_disp, 2, FUR_LCHK, FUR_HCHK, sign16_32(ext1));
+                }
+                break;
+        }
+    } else if (MIN == 0x80) {
+        decoded(d, OP_sleep, 0, 0, 0, 0);
+    } else if (MIN == 0xC0) {
+        decoded(d, OP_unimpl, 1, 0, 0, 0);
+        if (THR == 0x50) {
+            decoded(d, OP_mulxs_b, 1, FUR_H, FUR_L, 0);
+        } else if (THR == 0x52) {
+            decoded(d, OP_mulxs_w, 1, FUR_H, FUR_LCHK, 0);
+        }
+    } else if (MIN == 0xD0) {
+        decoded(d, OP_unimpl, 1, 0, 0, 0);
+        if (THR == 0x51) {
+            decoded(d, OP_divxs_b, 1, FUR_H, FUR_L, 0);
+        } else if (THR == 0x53) {
+            decoded(d, OP_divxs_w, 1, FUR_H, FUR_LCHK, 0);
+        }
+    } else if (MIN == 0xF0) {
+        // XOR.L and AND.L ERs,ERd aren't implemented
+        decoded(d, OP_unimpl, 1, 0, 0, 0);
+    }
+}
+
+static void dec_07(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_ldc, 0, 0, 0, MIN);
+}
+
+static void dec_08(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_add_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_09(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_add_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_0A(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 1 && MIN_LMSB == 0) {
+        decoded(d, OP_add_l, 0, MIN_HCHK, MIN_LCHK, 0);
+    } else if (MIN_H == 0) {
+        decoded(d, OP_inc_b, 0, 0, MIN_L, 0);
+    }
+}
+
+static void dec_0B(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // FIXME spec might be wrong about ADDS
+    if (MIN_H == 0 && MIN_LMSB == 0) {
+        decoded(d, OP_adds, 0, 0, MIN_LCHK, 1);
+    } else if (MIN_H == 8 && MIN_LMSB == 0) {
+        decoded(d, OP_adds, 0, 0, MIN_LCHK, 2);
+    } else if (MIN_H == 9 && MIN_LMSB == 0) {
+        decoded(d, OP_adds, 0, 0, MIN_LCHK, 4);
+    } else if (MIN_H == 5) {
+        decoded(d, OP_inc_w, 0, 0, MIN_L, 1);
+    } else if (MIN_H == 0xD) {
+        decoded(d, OP_inc_w, 0, 0, MIN_L, 2);
+    } else if (MIN_H == 7 && MIN_LMSB == 0) {
+        decoded(d, OP_inc_l, 0, 0, MIN_LCHK, 0);
+    }
+}
+
+static void dec_0C(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mov_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_0D(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mov_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_0E(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_addx, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_0F(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 1 && MIN_LMSB == 0) {
+        decoded(d, OP_mov_l, 0, MIN_HCHK, MIN_LCHK, 0);
+    }
+}
+
+static void dec_10(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_H == 0) {
+        decoded(d, OP_shll_b, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 1) {
+        decoded(d, OP_shll_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 3 && MIN_LMSB == 0) {
+        decoded(d, OP_shll_l, 0, 0, MIN_LCHK, 0);
+    }
+}
+
+static void dec_11(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_H == 0) {
+        decoded(d, OP_shlr_b, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 1) {
+        decoded(d, OP_shlr_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 3 && MIN_LMSB == 0) {
+        decoded(d, OP_shlr_l, 0, 0, MIN_LCHK, 0);
+    } else if (MIN_H == 9) {
+        decoded(d, OP_shar_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 0xB && MIN_LMSB == 0) {
+        decoded(d, OP_shar_l, 0, 0, MIN_LCHK, 0);
+    }
+}
+
+static void dec_12(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // ROTXL isn't implemented
+    if (MIN_H == 8) {
+        decoded(d, OP_rotl_b, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 9) {
+        decoded(d, OP_rotl_w, 0, 0, MIN_L, 0);
+    }
+}
+
+static void dec_14(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_or_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_15(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_xor_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_16(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_and_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_17(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // NOT.W isn't implemented
+    if (MIN_H == 0) {
+        decoded(d, OP_not_b, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 5) {
+        decoded(d, OP_extu_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 7 && MIN_LMSB == 0) {
+        decoded(d, OP_extu_l, 0, 0, MIN_LCHK, 0);
+    } else if (MIN_H == 8) {
+        decoded(d, OP_neg_b, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 9) {
+        decoded(d, OP_neg_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 0xD) {
+        decoded(d, OP_exts_w, 0, 0, MIN_L, 0);
+    } else if (MIN_H == 0xF && MIN_LMSB == 0) {
+        decoded(d, OP_exts_l, 0, 0, MIN_LCHK, 0);
+    }
+}
+
+static void dec_18(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_sub_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_19(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_sub_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_1A(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_H == 0) {
+        decoded(d, OP_dec_b, 0, 0, MIN_L, 0);
+    } else if (MIN_HMSB == 1 && MIN_LMSB == 0) {
+        decoded(d, OP_sub_l, 0, MIN_HCHK, MIN_LCHK, 0);
+    }
+}
+
+static void dec_1B(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_H == 0 && MIN_LMSB == 0) {
+        decoded(d, OP_subs, 0, 0, MIN_LCHK, 1);
+    } else if (MIN_H == 8 && MIN_LMSB == 0) {
+        decoded(d, OP_subs, 0, 0, MIN_LCHK, 2);
+    } else if (MIN_H == 9 && MIN_LMSB == 0) {
+        decoded(d, OP_subs, 0, 0, MIN_LCHK, 4);
+    } else if (MIN_H == 5) {
+        decoded(d, OP_dec_w, 0, 0, MIN_L, 0);
+    }
+}
+
+static void dec_1C(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_cmp_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_1D(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_cmp_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_1E(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_subx, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_1F(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 1 && MIN_LMSB == 0) {
+        decoded(d, OP_cmp_l, 0, MIN_HCHK, MIN_LCHK, 0);
+    }
+}
+
+static void dec_2x(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mov_b_ld_abs8, 0, 0, MAJ_L, ABS8(MIN));
+}
+
+static void dec_3x(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mov_b_st_abs8, 0, MAJ_L, 0, ABS8(MIN));
+}
+
+static void dec_4x(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_bcc_8, 0, MAJ_L, 0, sign8_32(MIN) + addr + 2);
+}
+
+static void dec_50(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mulxu_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_51(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_divxu_b, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_52(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_LMSB == 0) {
+        decoded(d, OP_mulxu_w, 0, MIN_H, MIN_LCHK, 0);
+    }
+}
+
+static void dec_53(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_LMSB == 0) {
+        decoded(d, OP_divxu_w, 0, MIN_H, MIN_LCHK, 0);
+    }
+}
+
+static void dec_54(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN == 0x70) {
+        decoded(d, OP_rts, 0, 0, 0, 0);
+    }
+}
+
+static void dec_55(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_bsr_8, 0, 0, 0, ((int32_t)(int8_t)MIN) + addr + 2);
+}
+
+static void dec_56(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN == 0x70) {
+        decoded(d, OP_rte, 0, 0, 0, 0);
+    }
+}
+
+static void dec_58(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_L == 0) {
+        decoded(d, OP_bcc_16, 1, MIN_H, 0, sign16_32(instr3_4) + addr + 4);
+    }
+}
+
+static void dec_59(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0 && MIN_L == 0) {
+        decoded(d, OP_jmp_ind, 0, MIN_HCHK, 0, 0);
+    }
+}
+
+static void dec_5A(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    uint16_t target = (MIN << 8) | THR_FUR;
+    decoded(d, OP_jmp_abs, 1, 0, 0, ABS24(target));
+}
+
+static void dec_5B(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_jmp_mem, 0, 0, 0, MIN);
+}
+
+static void dec_5C(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    if (MIN == 0) {
+        decoded(d, OP_bsr_16, 1, 0, 0, ((int32_t)(int16_t)THR_FUR) + addr + 4);
+    }
+}
+
+static void dec_5D(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0 && MIN_L == 0) {
+        decoded(d, OP_jsr_ind, 0, MIN_HCHK, 0, 0);
+    }
+}
+
+static void dec_5E(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_jsr_abs, 1, 0, 0, (MIN << 16) | THR_FUR);
+}
+
+static void dec_5F(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_jsr_mem, 0, 0, 0, MIN);
+}
+
+static void dec_60(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_bset_r, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_64(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_or_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_65(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_xor_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_66(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_and_w, 0, MIN_H, MIN_L, 0);
+}
+
+static void dec_67(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_bst, 0, MIN_HCHK, MIN_L, 0);
+    }
+}
+
+static void dec_68(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_b_ld_ind, 0, MIN_HCHK, MIN_L, 0);
+    } else {
+        decoded(d, OP_mov_b_st_ind, 0, MIN_L, MIN_HCHK, 0);
+    }
+}
+
+static void dec_69(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_w_ld_ind, 0, MIN_HCHK, MIN_L, 0);
+    } else {
+        decoded(d, OP_mov_w_st_ind, 0, MIN_L, MIN_HCHK, 0);
+    }
+}
+
+static void dec_6A(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // @aa:24, MOVFPE and MOVTPE aren't implemented, except that MOVFPE
+    // has always run as the store below it
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    switch (MIN_H) {
+        case 0:
+            decoded(d, OP_mov_b_ld_abs16, 1, 0, MIN_L, ABS16(THR_FUR));
+            break;
+        case 4:
+        case 8:
+            decoded(d, OP_mov_b_st_abs16, 1, MIN_L, 0, ABS16(THR_FUR));
+            break;
+    }
+}
+
+static void dec_6B(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    switch (MIN_H) {
+        case 0:
+            decoded(d, OP_mov_w_ld_abs16, 1, 0, MIN_L, ABS16(THR_FUR));
+            break;
+        case 2:
+            // the other forms have always run as the @aa:16 store
+            if (THR == 0) {
+                decoded(d, OP_mov_w_ld_abs24, 1, MIN_L, 0, ABS16(THR_FUR));
+                d->len = 6;
+            } else {
+                decoded(d, OP_mov_w_st_abs16, 1, MIN_L, 0, ABS16(THR_FUR));
+            }
+            break;
+        case 8:
+            decoded(d, OP_mov_w_st_abs16, 1, MIN_L, 0, ABS16(THR_FUR));
+            break;
+        case 0xA:
+            if (THR == 0) {
+                decoded(d, OP_mov_w_st_abs24, 1, MIN_L, 0, 0);
+                d->len = 6;
+            }
+            break;
+    }
+}
+
+static void dec_6C(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_b_ld_inc, 0, MIN_HCHK, MIN_L, 0);
+    } else {
+        decoded(d, OP_mov_b_st_dec, 0, MIN_L, MIN_HCHK, 0);
+    }
+}
+
+static void dec_6D(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // MOV.W Rs,@-ERd isn't implemented
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_w_ld_inc, 0, MIN_HCHK, MIN_L, 0);
+    } else if (MIN_H == 0xF) {
+        decoded(d, OP_push_w, 0, MIN_L, 0, 0);
+    }
+}
+
+static void dec_6E(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_b_ld_disp, 1, MIN_HCHK, MIN_L, sign16_32(THR_FUR));
+    } else {
+        decoded(d, OP_mov_b_st_disp, 1, MIN_L, MIN_HCHK, sign16_32(THR_FUR));
+    }
+}
+
+static void dec_6F(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_mov_w_ld_disp, 1, MIN_HCHK, MIN_L, sign16_32(THR_FUR));
+    } else {
+        decoded(d, OP_mov_w_st_disp, 1, MIN_L, MIN_HCHK, sign16_32(THR_FUR));
+    }
+}
+
+static void dec_70(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_bset, 0, MIN_HCHK, MIN_L, 0);
+}
+
+static void dec_73(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_btst, 0, MIN_HCHK, MIN_L, 0);
+}
+
+static void dec_77(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_HMSB == 0) {
+        decoded(d, OP_bld, 0, MIN_HCHK, MIN_L, 0);
+    }
+}
+
+static void dec_78(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // MOV with @(d:24,ERn) isn't implemented
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+}
+
+static void dec_79(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    if (MIN_H == 0) {
+        decoded(d, OP_mov_w_imm, 1, 0, MIN_L, THR_FUR);
+    } else if (MIN_H == 1) {
+        decoded(d, OP_add_w_imm, 1, 0, MIN_L, THR_FUR);
+    } else if (MIN_H == 2) {
+        decoded(d, OP_cmp_w_imm, 1, 0, MIN_L, THR_FUR);
+    } else if (MIN_H == 6) {
+        decoded(d, OP_and_w_imm, 1, 0, MIN_L, THR_FUR);
+    } else if (MIN_H == 3) {
+        decoded(d, OP_sub_w_imm, 1, 0, MIN_L, THR_FUR);
+    } else if (MIN_H == 4) {
+        decoded(d, OP_or_w_imm, 1, 0, MIN_L, THR_FUR);
+    }
+}
+
+static void dec_7A(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // SUB.L and OR.L #xx:32,ERd aren't implemented
+    uint32_t imm = ((uint32_t)instr3_4 << 16) | ext1;
+    if (MIN_H == 1 && MIN_LMSB == 0) {
+        decoded(d, OP_add_l_imm, 2, 0, MIN_LCHK, imm);
+    } else if (MIN_H == 2 && MIN_LMSB == 0) {
+        decoded(d, OP_cmp_l_imm, 2, 0, MIN_LCHK, imm);
+    } else if (MIN_H == 6 && MIN_LMSB == 0) {
+        decoded(d, OP_and_l_imm, 2, 0, MIN_LCHK, imm);
+    } else if (MIN_H == 0 && MIN_LMSB == 0) {
+        decoded(d, OP_mov_l_imm, 2, 0, MIN_LCHK, imm);
+    }
+}
+
+static void dec_7B(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // EEPMOV isn't implemented
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+}
+
+static void dec_7D(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    if (MIN_HMSB == 0 && MIN_L == 0 && THR == 0x70 &&
+        FUR_HMSB == 0 && FUR_L == 0) {
+        decoded(d, OP_bset_ind, 1, FUR_HCHK, MIN_HCHK, 0);
+    } else if (MIN_HMSB == 0 && MIN_L == 0 && THR == 0x72 &&
+        FUR_HMSB == 0 && FUR_L == 0) {
+        decoded(d, OP_bclr_ind, 1, FUR_HCHK, MIN_HCHK, 0);
+    } else if (THR == 0x67) {
+        decoded(d, OP_bst_ind, 1, FUR_HCHK, MIN_HCHK, 0);
+    } else if (THR == 0x71) {
+        decoded(d, OP_bnot_ind, 1, FUR_HCHK, MIN_HCHK, 0);
+    }
+}
+
+static void dec_7E(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    // of the bit operations on @aa:8 only BAND and BLD are implemented
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    if (THR == 0x76 && FUR_HMSB == 0) {
+        decoded(d, OP_band_abs8, 1, FUR_HCHK, 0, ABS8(MIN));
+    } else if (THR == 0x77 && FUR_HMSB == 0) {
+        decoded(d, OP_bld_abs8, 1, FUR_HCHK, 0, ABS8(MIN));
+    }
+}
+
+static void dec_7F(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_unimpl, 1, 0, 0, 0);
+    if (THR == 0x70) {
+        decoded(d, OP_bset_abs8, 1, FUR_HCHK, 0, ABS8(MIN));
+    } else if (THR == 0x72) {
+        decoded(d, OP_bclr_abs8, 1, FUR_HCHK, 0, ABS8(MIN));
+    }
+}
+
+static void dec_8x(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_add_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_9x(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_addx_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Ax(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_cmp_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Bx(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_subx_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Cx(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_or_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Dx(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_xor_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Ex(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_and_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+static void dec_Fx(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+    decoded(d, OP_mov_b_imm, 0, 0, MAJ_L, MIN);
+}
+
+// Major opcodes without a single implemented form
+static void dec_none(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t instr3_4, uint16_t ext1) {
+}
+
+static const instr_decoder decoders[256] = {
+/* 0 */ dec_00, dec_01, dec_none, dec_none, dec_none, dec_none, dec_none, dec_07, dec_08, dec_09, dec_0A, dec_0B, dec_0C, dec_0D, dec_0E, dec_0F,
+/* 1 */ dec_10, dec_11, dec_12, dec_none, dec_14, dec_15, dec_16, dec_17, dec_18, dec_19, dec_1A, dec_1B, dec_1C, dec_1D, dec_1E, dec_1F,
+/* 2 */ dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x, dec_2x,
+/* 3 */ dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x, dec_3x,
+/* 4 */ dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x, dec_4x,
+/* 5 */ dec_50, dec_51, dec_52, dec_53, dec_54, dec_55, dec_56, dec_none, dec_58, dec_59, dec_5A, dec_5B, dec_5C, dec_5D, dec_5E, dec_5F,
+/* 6 */ dec_60, dec_none, dec_none, dec_none, dec_64, dec_65, dec_66, dec_67, dec_68, dec_69, dec_6A, dec_6B, dec_6C, dec_6D, dec_6E, dec_6F,
+/* 7 */ dec_70, dec_none, dec_none, dec_73, dec_none, dec_none, dec_none, dec_77, dec_78, dec_79, dec_7A, dec_7B, dec_none, dec_7D, dec_7E, dec_7F,
+/* 8 */ dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x, dec_8x,
+/* 9 */ dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x, dec_9x,
+/* A */ dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax, dec_Ax,
+/* B */ dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx, dec_Bx,
+/* C */ dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx, dec_Cx,
+/* D */ dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx, dec_Dx,
+/* E */ dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex, dec_Ex,
+/* F */ dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx, dec_Fx,
+};
+
+static void decode(pw_decoded_t *d, uint16_t addr, uint16_t instr, uint16_t ext0, uint16_t ext1) {
+    decoded(d, OP_unimpl, 0, 0, 0, 0);
+    d->instr = instr;
+    decoders[instr >> 8](d, addr, instr, ext0, ext1);
+}
+
+static const pw_decoded_t *decode_at(pw_context_t *ctx, uint16_t addr) {
+    if (likely(addr <= ROM_end && !(addr & 1))) {
+        return &ctx->decode_cache[addr >> 1];
+    }
+    // RAM can change under us, so don't cache it
+    decode(&ctx->decode_scratch, addr, peek16(ctx, addr), peek16(ctx, addr+2), peek16(ctx, addr+4));
+    return &ctx->decode_scratch;
+}
+
+// Fetch the opcode at ctx->ip, replaces read16(ctx, ctx->ip)
+static void prefetch(pw_context_t *ctx) {
+    ctx->word_access++;
+    ON_CHIP_MEM_ACCESS;
+    ctx->cur = decode_at(ctx, ctx->ip);
+    ctx->instr_prefetch = ctx->cur->instr;
+}
+
+static void ssu_dummy_write(pw_context_t *ctx, uint8_t byte) {
+    printf("SSU UNK WRITE %x\n", byte);
+}
+
+static uint8_t ssu_dummy_read(pw_context_t *ctx) {
+    printf("SSU UNK READ\n");
+    return 0;
+}
+
+#define SSU_CB(ssu, read_cb, write_cb, data_ptr) \
+    ssu_callbacks(ssu, (ssu_read_callback_t)read_cb, (ssu_write_callback_t)write_cb, data_ptr)
+
+// Points the SSU at a device. The choice is kept in the context so it can
+// be reapplied after a snapshot is loaded.
+static void ssu_select(pw_context_t *ctx, enum ssu_target target) {
+    switch (target) {
+        case SSU_EEPROM:
+            SSU_CB(&ctx->ssu, eeprom_spi_read, eeprom_spi_write, &ctx->eeprom);
+            break;
+        case SSU_LCD_DATA:
+            SSU_CB(&ctx->ssu, NULL, lcd_data, &ctx->lcd);
+            break;
+        case SSU_LCD_CMD:
+            SSU_CB(&ctx->ssu, NULL, lcd_cmd, &ctx->lcd);
+            break;
+        case SSU_ACCEL:
+            SSU_CB(&ctx->ssu, accel_read, accel_write, &ctx->accel);
+            break;
+        default:
+            SSU_CB(&ctx->ssu, ssu_dummy_read, ssu_dummy_write, ctx);
+            break;
+    }
+    ctx->ssu_target = target;
+}
+
+static uint8_t io2_get_pdr1(pw_context_t *ctx) {
+    return ctx->pdr1;
+}
+
+static void io2_set_pdr1(pw_context_t *ctx, uint8_t val) {
+    if (!(val & 4)) {
+        ssu_select(ctx, SSU_EEPROM);
+    } else if (!(val & 1)) {
+        if (val & 2) {
+            ssu_select(ctx, SSU_LCD_DATA);
+        } else {
+            ssu_select(ctx, SSU_LCD_CMD);
+        }
+    } else {
+        ssu_select(ctx, SSU_NONE);
+        eeprom_stop(&ctx->eeprom);
+    }
+    ctx->pdr1 = val;
+}
+
+static uint8_t io2_get_pdr9(pw_context_t *ctx) {
+    return ctx->pdr9;
+}
+
+static void io2_set_pdr9(pw_context_t *ctx, uint8_t val) {
+    if (val & 1) {
+        ssu_select(ctx, SSU_NONE);
+        accel_stop(&ctx->accel);
+    } else {
+        ssu_select(ctx, SSU_ACCEL);
+    }
+    ctx->pdr9 = val;
+}
+
+static void verifyStates(pw_context_t *ctx, uint16_t ip) {
+    int ba = ctx->l;
+    int wa = ctx->i + ctx->j + ctx->k + ctx->m;
+    int in = ctx->n;
+    if (ctx->byte_access != ba || ctx->word_access != wa || ctx->internal_states != in) {
+        printf("WRONG STATES AT %04x (B:%d W:%d I:%d) - I:%d J:%d K:%d L:%d M:%d N:%d\n", 
+            ip, ctx->byte_access, ctx->word_access, ctx->internal_states, ctx->i, ctx->j, ctx->k, ctx->l, ctx->m, ctx->n);
+    }
+    ctx->byte_access = 0;
+    ctx->word_access = 0;
+    ctx->internal_states = 0;
+}
+
+static void interrupt(pw_context_t *ctx, enum interrupts inter) {
+    uint8_t ccr = get_ccr(ctx);
+
+    wake(ctx);
+
+    // Interrupt handling routine
+    //
+    // first read the "prefetch address"
+    // which is "2 plus PC value pushed on the stack"
+    // but "replaced by internal op when recovering from sleep or standby"
+    read16(ctx, ctx->ip + 2);
+    INTERNAL_STATES(2);
+    PUSHIP(ctx, ctx->ip);
+    // push ccr twice in normal mode for alignment
+    // (the higher byte is ignored by rte)
+    pushw(ctx, (ccr << 8) | ccr);
+    ctx->ip = read16(ctx, inter*2);
+    INTERNAL_STATES(2);
+    // finally read the first opcode of the handler
+    prefetch(ctx);
+
+    // TODO: UI bits and SYSCR
+    tmrw_sync(ctx);
+    ctx->int_enabled = 0;
+    tmrw_schedule(ctx);
+
+    STATES(2, 1, 2, 0, 0, 4);
+#ifndef PW_THREADED
+    // the threaded loop doesn't reset the access counts per instruction
+    verifyStates(ctx, ctx->ip);
+#endif
+
+    printf("INT %s %x\n", int_names[inter], ctx->ip);
+}
+
+void pw_reset(pw_context_t *ctx) {
+
+    memmap_init(ctx);
+
+    ctx->states = 0;
+    ctx->cycles = 0;
+    ctx->run_until = 0;
+    ctx->halted = 0;
+
+    // init all modules
+    sched_init(&ctx->sched);
+    ssu_init(&ctx->ssu);
+    eeprom_init(&ctx->eeprom, ctx->eeprom_data);
+    lcd_init(&ctx->lcd);
+    accel_init(&ctx->accel);
+    rtc_init(&ctx->rtc);
+    if (ctx->clock_emulated) {
+        rtc_set_clock(&ctx->rtc, ctx->clock_base);
+    }
+    pw_schedule(ctx, SCHED_RTC, RTC_POLL_STATES);
+    ssu_select(ctx, SSU_NONE);
+
+    ctx->syscr1 = 3;
+    ctx->syscr2 = 0xF0;
+    ctx->ckstpr1 = 3;
+    ctx->ckstpr2 = 4;
+    ctx->osccr = 0;
+
+    ctx->iegr  = 0;
+    ctx->ienr1 = 0;
+    ctx->ienr2 = 0;
+    ctx->irr1  = 0;
+    ctx->irr2  = 0;
+
+    ctx->tmrw = ~TMRW_TMRW_MASK & 0xFF;
+    ctx->tcrw = 0;
+    ctx->tierw = ~TMRW_TIERW_MASK & 0xFF;
+    ctx->tsrw = ~TMRW_TSRW_MASK & 0xFF;
+    ctx->tior0 = ~TMRW_TIOR0_MASK & 0xFF;
+    ctx->tior1 = ~TMRW_TIOR1_MASK & 0xFF;
+    ctx->tcnt = 0;
+    ctx->gra = 0xFFFF;
+    ctx->grb = 0xFFFF;
+    ctx->grc = 0xFFFF;
+    ctx->grd = 0xFFFF;
+
+    ctx->tmrw_rem = 0;
+    ctx->tmrw_synced = 0;
+
+    
+    ctx->mode = MODE_ACTIVE_HIGH;
+
+    ctx->byte_access = 0;
+    ctx->word_access = 0;
+    ctx->internal_states = 0;
+
+    // Reset routine for normal mode
+    //
+    // First read the entrypoint from the vector table
+    uint16_t entrypoint = read16(ctx, 0);
+    ctx->ip = entrypoint;
+    // then a 2 state internal operation
+    INTERNAL_STATES(2);
+    // then we read the first opcode
+    prefetch(ctx);
+
+    // FIXME: should not immediately allow interrupts
+    ctx->int_enabled = 1;
+
+    // init I bit of CCR
+    ctx->flags_op = FLAGS_NONE;
+    set_ccr_bit(ctx, CCR_I, 1);
+
+    STATES(1, 1, 0, 0, 0, 2);
+    verifyStates(ctx, 0);
+}
+
+static void bad_ip(pw_context_t *ctx) {
+    printf("Something went wrong at %x\n", ctx->ip);
+    for (int i = 0; i < 10; i++) {
+        printf("%.2x ", peek8(ctx, ctx->ip + i));
+    }
+    puts("");
+    ctx->halted = 1;
+}
+
+#ifndef PW_THREADED
+static void pw_step(pw_context_t *ctx) {
+    uint16_t oip = ctx->ip;
+
+    debug("%4x ", ctx->ip);
+    debug("%.4x ", ctx->instr_prefetch);
+    ctx->cur->handler(ctx, ctx->cur);
+    prefetch(ctx);
+
+    ctx->prev_ip = oip;
+
+    print_state(ctx);
+    verifyStates(ctx, ctx->prev_ip);
+    
+    if (oip == ctx->ip || ctx->ip > 0xBAC4) {
+        bad_ip(ctx);
+        return;
+    }
+}
+#endif
+
+static void tmrw_event(pw_context_t *ctx) {
+    tmrw_sync(ctx);
+    // compare match A
+    if (ctx->tcrw & (1 << TMRW_TCRW_CCLR_BIT)) {
+        ctx->tcnt = 0;
+        ctx->tmrw_rem = 0;
+    }
+    ctx->tsrw |= (1 << TMRW_TSRW_IMFA_BIT);
+    if (ctx->tierw & (1 << TMRW_TIERW_IMIEA_BIT)) {
+        interrupt(ctx, INT_TIMER_W);
+    }
+    tmrw_schedule(ctx);
+}
+
+// Input queue
+
+static void set_keys(pw_context_t *ctx, uint8_t keys) {
+    uint8_t old = portb_get_pdrb(&ctx->portb);
+    ctx->keys_pressed = keys;
+    // TODO: maybe invert keys pressed ?
+    portb_update(&ctx->portb, keys);
+    irq_pins_changed(ctx, old, portb_get_pdrb(&ctx->portb));
+}
+
+// Applies the queued inputs that are due and schedules the next one. Only
+// the thread running the instance gets here, it owns input_tail.
+static void input_apply(pw_context_t *ctx) {
+    uint64_t now = pw_now(ctx);
+    uint32_t tail = ctx->input_tail;
+    while (tail != load_acquire(&ctx->input_head)) {
+        pw_input_event_t *ev = &ctx->input_queue[tail % INPUT_QUEUE_SIZE];
+        if (ev->at > now) {
+            pw_schedule(ctx, SCHED_INPUT, ev->at);
+            return;
+        }
+        switch (ev->type) {
+            case PW_INPUT_KEYS:
+                set_keys(ctx, ev->value);
+                break;
+            default:
+                break;
+        }
+        tail++;
+        store_release(&ctx->input_tail, tail);
+    }
+    pw_unschedule(ctx, SCHED_INPUT);
+}
+
+// Takes the highest priority request, IRQs before the RTC. An IRQ flag
+// stays set until the handler clears it, and requests that come in while
+// a handler runs wait for its RTE.
+static void irq_event(pw_context_t *ctx) {
+    if (!ctx->int_enabled) {
+        return;
+    }
+    uint8_t pending = ctx->irr1 & ctx->ienr1 & INT_IRQ_MASK;
+    if (pending) {
+        interrupt(ctx, (pending & 1) ? INT_IRQ0 : INT_IRQ1);
+        return;
+    }
+    int rtc_int = rtc_poll_int(&ctx->rtc);
+    if (rtc_int != -1) {
+        interrupt(ctx, rtc_int);
+    }
+}
+
+// Handle every event that is due, then work out the next deadline
+static void run_events(pw_context_t *ctx) {
+    uint64_t now = pw_now(ctx);
+    int ev;
+    while ((ev = sched_pop(&ctx->sched, now)) != -1) {
+        switch (ev) {
+            case SCHED_TMRW:
+                tmrw_event(ctx);
+                break;
+            case SCHED_INPUT:
+                input_apply(ctx);
+                break;
+            case SCHED_IRQ:
+                irq_event(ctx);
+                break;
+            case SCHED_RTC:
+                rtc_update(&ctx->rtc, now / PW_STATES_PER_SECOND);
+                irq_update(ctx);
+                pw_schedule(ctx, SCHED_RTC, now + RTC_POLL_STATES);
+                break;
+            default:
+                break;
+        }
+    }
+    update_deadline(ctx);
+}
+
+#ifdef PW_JIT
+// Translates ROM basic blocks to x86-64 for the threaded loop. A block
+// runs the instructions it has a template for inline and calls the
+// handler for the rest, doing the loop's step bookkeeping after each one,
+// and ends at the first branch. Branches to a fixed address jump straight
+// into the next block once that one exists. Whenever the block can't
+// carry on by itself, because events are due, a handler went somewhere
+// it can't predict or the next instruction isn't translated, it returns
+// to the loop with the context just as the interpreter leaves it.
+//
+// Registers and the CCR stay in the context, the handlers and flags_eval
+// called from translated code work on them there. The access counters
+// are left alone, only the portable loop checks them. rbx holds the
+// context, r12 the instruction count and r13 where it goes at the end.
+
+#define JIT_CODE_SIZE    (2 << 20)
+#define JIT_BLOCK_INSTRS 32
+// enough for the largest block and its exit stubs
+#define JIT_BLOCK_ROOM   (32 << 10)
+#define JIT_MAX_STUBS    (4 * JIT_BLOCK_INSTRS + 4)
+// pw_run stops with bad_ip past this
+#define JIT_IP_MAX       0xBAC4
+
+// pw_jit.map entries that aren't code offsets, the entry code sits there
+#define JIT_UNTRANSLATED 0
+#define JIT_NO_BLOCK     1
+
+// How translated code hands back to jit_run
+enum jit_exit {
+    JIT_INTERP, // the instruction at ctx->ip is left to the interpreter
+    JIT_NEXT,   // a handler ran, prev_ip has its address, the loop finishes the step
+    JIT_EVENTS, // the step is done and events are due
+    JIT_LINK,   // the step is done, the upper bits locate the jump to patch
+};
+
+typedef uint32_t (*jit_entry_t)(pw_context_t *ctx, const uint8_t *code, long *count);
+
+typedef struct pw_jit {
+    uint8_t *code;
+    // where the next block goes, blocks start after the entry code
+    uint8_t *p;
+    uint8_t *blocks;
+    uint8_t *leave;
+    jit_entry_t enter;
+    // bumped whenever the translations are thrown away
+    uint32_t flushes;
+    // code offset of the block starting at each ROM word
+    uint32_t map[DECODE_CACHE_SIZE];
+} pw_jit_t;
+
+enum jit_stub_kind {
+    STUB_EVENTS,
+    STUB_NEXT,
+    STUB_SLOW,
+    STUB_LINK,
+};
+
+// Out of line code at the end of a block, for the paths leaving it
+typedef struct jit_stub {
+    enum jit_stub_kind kind;
+    // rel32 of the jump to the stub
+    uint8_t *rel;
+    uint16_t ip;
+    uint16_t prev_ip;
+    const pw_decoded_t *d;
+    // where STUB_SLOW continues
+    uint8_t *resume;
+} jit_stub_t;
+
+typedef struct jit_block {
+    pw_jit_t *jit;
+    jit_stub_t stubs[JIT_MAX_STUBS];
+    int num_stubs;
+} jit_block_t;
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+#define CTX_OFF(field) ((uint32_t)offsetof(pw_context_t, field))
+
+#define JCC_E  0x0F84
+#define JCC_NE 0x0F85
+#define JCC_GE 0x0F8D
+#define JMP    0xE9
+
+static void jit_u8(pw_jit_t *j, uint8_t v) {
+    *j->p++ = v;
+}
+
+static void jit_u16(pw_jit_t *j, uint16_t v) {
+    memcpy(j->p, &v, 2);
+    j->p += 2;
+}
+
+static void jit_u32(pw_jit_t *j, uint32_t v) {
+    memcpy(j->p, &v, 4);
+    j->p += 4;
+}
+
+static void jit_u64(pw_jit_t *j, uint64_t v) {
+    memcpy(j->p, &v, 8);
+    j->p += 8;
+}
+
+// One or two opcode bytes
+static void jit_op(pw_jit_t *j, uint32_t op) {
+    if (op > 0xFF) {
+        jit_u8(j, op >> 8);
+    }
+    jit_u8(j, op);
+}
+
+// Instruction with a [rbx+off] operand
+static void jit_mem(pw_jit_t *j, uint32_t op, int reg, uint32_t off) {
+    jit_op(j, op);
+    jit_u8(j, 0x80 | (reg << 3) | RBX);
+    jit_u32(j, off);
+}
+
+// Instruction with two host registers
+static void jit_rr(pw_jit_t *j, uint32_t op, int reg, int rm) {
+    jit_op(j, op);
+    jit_u8(j, 0xC0 | (reg << 3) | rm);
+}
+
+static void jit_mov_imm(pw_jit_t *j, int reg, uint32_t v) {
+    jit_u8(j, 0xB8 + reg);
+    jit_u32(j, v);
+}
+
+// Jump with its rel32 left for jit_land, returns where the rel32 is
+static uint8_t *jit_jump(pw_jit_t *j, uint32_t op) {
+    jit_op(j, op);
+    uint8_t *rel = j->p;
+    jit_u32(j, 0);
+    return rel;
+}
+
+static void jit_land(uint8_t *rel, const uint8_t *target) {
+    int32_t d = (int32_t)(target - (rel + 4));
+    memcpy(rel, &d, 4);
+}
+
+// Calls fn(ctx) or fn(ctx, d)
+static void jit_call(pw_jit_t *j, uintptr_t fn, const pw_decoded_t *d) {
+    jit_rr(j, 0x4889, RBX, RDI);
+    if (d != NULL) {
+        jit_op(j, 0x48BE);
+        jit_u64(j, (uintptr_t)d);
+    }
+    jit_op(j, 0x48B8);
+    jit_u64(j, fn);
+    jit_rr(j, 0xFF, 2, RAX);
+}
+
+static void jit_set_ip(pw_jit_t *j, uint32_t off, uint16_t ip) {
+    jit_mem(j, 0x66C7, 0, off);
+    jit_u16(j, ip);
+}
+
+static void jit_exit(pw_jit_t *j, uint32_t status) {
+    jit_mov_imm(j, RAX, status);
+    jit_land(jit_jump(j, JMP), j->leave);
+}
+
+static void jit_stub(jit_block_t *b, enum jit_stub_kind kind, uint8_t *rel, uint16_t ip, uint16_t prev_ip,
+                     const pw_decoded_t *d, uint8_t *resume) {
+    jit_stub_t *s = &b->stubs[b->num_stubs++];
+    assert(b->num_stubs <= JIT_MAX_STUBS);
+    s->kind = kind;
+    s->rel = rel;
+    s->ip = ip;
+    s->prev_ip = prev_ip;
+    s->d = d;
+    s->resume = resume;
+}
+
+static uint32_t reg8_off(int r) {
+    return CTX_OFF(regs) + 2 * (r & 7) + !(r & 8);
+}
+
+static uint32_t reg16_off(int r) {
+    return CTX_OFF(regs) + 2 * r;
+}
+
+// Zero extended register of the given size in bytes into dst, esi is
+// clobbered for ERn
+static void jit_get_reg(pw_jit_t *j, int size, int dst, int r) {
+    if (size == 1) {
+        jit_mem(j, 0x0FB6, dst, reg8_off(r));
+    } else if (size == 2) {
+        jit_mem(j, 0x0FB7, dst, reg16_off(r));
+    } else {
+        jit_mem(j, 0x0FB7, dst, reg16_off(r + 8));
+        jit_rr(j, 0xC1, 4, dst);
+        jit_u8(j, 16);
+        jit_mem(j, 0x0FB7, RSI, reg16_off(r));
+        jit_rr(j, 0x09, RSI, dst);
+    }
+}
+
+// src is eax, ecx or edx, esi is clobbered for ERn
+static void jit_set_reg(pw_jit_t *j, int size, int src, int r) {
+    if (size == 1) {
+        jit_mem(j, 0x88, src, reg8_off(r));
+    } else if (size == 2) {
+        jit_mem(j, 0x6689, src, reg16_off(r));
+    } else {
+        jit_mem(j, 0x6689, src, reg16_off(r));
+        jit_rr(j, 0x89, src, RSI);
+        jit_rr(j, 0xC1, 5, RSI);
+        jit_u8(j, 16);
+        jit_mem(j, 0x6689, RSI, reg16_off(r + 8));
+    }
+}
+
+static enum flags_op jit_flags_op(int sub, int size) {
+    if (size == 1) {
+        return sub ? FLAGS_SUB8 : FLAGS_MOV8;
+    }
+    if (size == 2) {
+        return sub ? FLAGS_SUB16 : FLAGS_MOV16;
+    }
+    return sub ? FLAGS_SUB32 : FLAGS_MOV32;
+}
+
+// The check at the top of set_flags. Comes before anything is loaded,
+// flags_eval clobbers the scratch registers.
+static void jit_flags_pending(pw_jit_t *j, enum flags_op op) {
+    uint32_t pending = 0;
+    for (uint32_t i = 0; i < sizeof(flags_mask) / sizeof(flags_mask[0]); i++) {
+        if (flags_mask[i] & ~flags_mask[op]) {
+            pending |= 1u << i;
+        }
+    }
+    if (pending == 0) {
+        return;
+    }
+    jit_mem(j, 0x8B, RAX, CTX_OFF(flags_op));
+    jit_mov_imm(j, RCX, pending);
+    jit_rr(j, 0x0FA3, RAX, RCX);
+    // jnc over the call
+    jit_u8(j, 0x73);
+    uint8_t *skip = j->p++;
+    jit_call(j, (uintptr_t)flags_eval, NULL);
+    *skip = (uint8_t)(j->p - (skip + 1));
+}
+
+// The rest of set_flags, a and b are -1 for zero
+static void jit_flags_set(pw_jit_t *j, enum flags_op op, int a, int b, int res) {
+    jit_mem(j, 0xC7, 0, CTX_OFF(flags_op));
+    jit_u32(j, op);
+    if (a < 0) {
+        jit_mem(j, 0xC7, 0, CTX_OFF(flags_a));
+        jit_u32(j, 0);
+    } else {
+        jit_mem(j, 0x89, a, CTX_OFF(flags_a));
+    }
+    if (b < 0) {
+        jit_mem(j, 0xC7, 0, CTX_OFF(flags_b));
+        jit_u32(j, 0);
+    } else {
+        jit_mem(j, 0x89, b, CTX_OFF(flags_b));
+    }
+    jit_mem(j, 0x89, res, CTX_OFF(flags_res));
+#ifdef PW_EAGER_FLAGS
+    jit_call(j, (uintptr_t)flags_eval, NULL);
+#endif
+}
+
+enum jit_alu {
+    ALU_MOV,
+    ALU_ADD,
+    ALU_SUB,
+    ALU_CMP,
+    ALU_AND,
+    ALU_OR,
+    ALU_XOR,
+};
+
+// Rd = Rd op Rs, or op #imm when rs is -1, with the same flags as the
+// helper the handler uses. ADD doesn't touch them.
+static void jit_alu(pw_jit_t *j, enum jit_alu alu, int size, int rd, int rs, uint32_t imm) {
+    int sub = alu == ALU_SUB || alu == ALU_CMP;
+    enum flags_op op = jit_flags_op(sub, size);
+
+    if (alu != ALU_ADD) {
+        jit_flags_pending(j, op);
+    }
+    if (rs < 0) {
+        jit_mov_imm(j, RCX, size == 4 ? imm : imm & ((1u << (8 * size)) - 1));
+    } else {
+        jit_get_reg(j, size, RCX, rs);
+    }
+    if (alu == ALU_MOV) {
+        jit_rr(j, 0x89, RCX, RAX);
+    } else {
+        jit_get_reg(j, size, RAX, rd);
+    }
+    switch (alu) {
+        case ALU_ADD:
+            jit_rr(j, 0x01, RCX, RAX);
+            break;
+        case ALU_SUB:
+        case ALU_CMP:
+            jit_rr(j, 0x89, RAX, RDX);
+            jit_rr(j, 0x29, RCX, RAX);
+            if (size < 4) {
+                jit_rr(j, size == 1 ? 0x0FB6 : 0x0FB7, RAX, RAX);
+            }
+            break;
+        case ALU_AND:
+            jit_rr(j, 0x21, RCX, RAX);
+            break;
+        case ALU_OR:
+            jit_rr(j, 0x09, RCX, RAX);
+            break;
+        case ALU_XOR:
+            jit_rr(j, 0x31, RCX, RAX);
+            break;
+        default:
+            break;
+    }
+    if (alu != ALU_CMP) {
+        jit_set_reg(j, size, RAX, rd);
+    }
+    if (alu != ALU_ADD) {
+        jit_flags_set(j, op, sub ? RDX : -1, sub ? RCX : -1, RAX);
+    }
+}
+
+// ERd += imm, imm is negative for SUBS
+static void jit_add32(pw_jit_t *j, int rd, uint32_t imm) {
+    jit_get_reg(j, 4, RAX, rd);
+    jit_rr(j, 0x81, 0, RAX);
+    jit_u32(j, imm);
+    jit_set_reg(j, 4, RAX, rd);
+}
+
+// MOV.B and MOV.W between a register and memory the page tables cover.
+// Everything else, the I/O registers among it, takes the slow path,
+// which hands the instruction to its handler. base is the address
+// register, -1 for an absolute address in disp. The host address is kept
+// in r14 while set_flags' check may call out.
+static int jit_mov_mem(jit_block_t *b, const pw_decoded_t *d, uint16_t addr, int size, int store, int base,
+                       uint32_t disp) {
+    pw_jit_t *j = b->jit;
+    uint32_t pages = store ? CTX_OFF(write_pages) : CTX_OFF(read_pages);
+
+    if (base < 0 && size == 2 && (disp & PAGE_MASK) == PAGE_MASK) {
+        // straddles two pages, always slow
+        return 0;
+    }
+    if (base < 0) {
+        disp &= 0xFFFF;
+        jit_mem(j, 0x488B, RDX, pages + sizeof(void *) * (disp >> PAGE_SHIFT));
+        jit_mov_imm(j, RAX, disp & PAGE_MASK);
+    } else {
+        jit_mem(j, 0x0FB7, RAX, reg16_off(base));
+        if (disp != 0) {
+            jit_rr(j, 0x81, 0, RAX);
+            jit_u32(j, disp);
+            jit_rr(j, 0x0FB7, RAX, RAX);
+        }
+        // rdx = pages[eax >> PAGE_SHIFT]
+        jit_rr(j, 0x89, RAX, RCX);
+        jit_rr(j, 0xC1, 5, RCX);
+        jit_u8(j, PAGE_SHIFT);
+        jit_op(j, 0x488B);
+        jit_u8(j, 0x94);
+        jit_u8(j, 0xCB);
+        jit_u32(j, pages);
+        jit_rr(j, 0x83, 4, RAX);
+        jit_u8(j, PAGE_MASK);
+    }
+    jit_rr(j, 0x4885, RDX, RDX);
+    jit_stub(b, STUB_SLOW, jit_jump(j, JCC_E), addr, 0, d, NULL);
+    if (base >= 0 && size == 2) {
+        jit_rr(j, 0x83, 7, RAX);
+        jit_u8(j, PAGE_MASK);
+        jit_stub(b, STUB_SLOW, jit_jump(j, JCC_E), addr, 0, d, NULL);
+    }
+    // lea r14, [rdx+rax]
+    jit_op(j, 0x4C8D);
+    jit_u8(j, 0x34);
+    jit_u8(j, 0x02);
+    jit_flags_pending(j, jit_flags_op(0, size));
+    if (store) {
+        jit_get_reg(j, size, RCX, d->rs);
+        if (size == 1) {
+            // mov [r14], cl
+            jit_op(j, 0x4188);
+            jit_u8(j, 0x0E);
+        } else {
+            // esi = ecx big endian, mov [r14], si
+            jit_rr(j, 0x89, RCX, RSI);
+            jit_rr(j, 0x66C1, 0, RSI);
+            jit_u8(j, 8);
+            jit_u8(j, 0x66);
+            jit_op(j, 0x4189);
+            jit_u8(j, 0x36);
+        }
+    } else {
+        // movzx ecx, byte/word [r14]
+        jit_u8(j, 0x41);
+        jit_op(j, size == 1 ? 0x0FB6 : 0x0FB7);
+        jit_u8(j, 0x0E);
+        if (size == 2) {
+            jit_rr(j, 0x66C1, 0, RCX);
+            jit_u8(j, 8);
+        }
+        jit_set_reg(j, size, RCX, d->rd);
+    }
+    jit_flags_set(j, jit_flags_op(0, size), -1, -1, RCX);
+    return 1;
+}
+
+// Emits the instruction if there is a template for it. Returns 0 if not,
+// or the states it spends, the operand fetches and memory accesses.
+static int jit_template(jit_block_t *b, const pw_decoded_t *d, uint16_t addr) {
+    pw_jit_t *j = b->jit;
+    int mem;
+    int fetch = 2 * d->fetches;
+
+    switch (d->op) {
+        case OP_nop:
+            return 2;
+        case OP_add_b:      jit_alu(j, ALU_ADD, 1, d->rd, d->rs, 0); break;
+        case OP_add_w:      jit_alu(j, ALU_ADD, 2, d->rd, d->rs, 0); break;
+        case OP_add_l:      jit_alu(j, ALU_ADD, 4, d->rd, d->rs, 0); break;
+        case OP_add_b_imm:  jit_alu(j, ALU_ADD, 1, d->rd, -1, d->imm); break;
+        case OP_add_w_imm:  jit_alu(j, ALU_ADD, 2, d->rd, -1, d->imm); break;
+        case OP_add_l_imm:  jit_alu(j, ALU_ADD, 4, d->rd, -1, d->imm); break;
+        case OP_mov_b:      jit_alu(j, ALU_MOV, 1, d->rd, d->rs, 0); break;
+        case OP_mov_w:      jit_alu(j, ALU_MOV, 2, d->rd, d->rs, 0); break;
+        case OP_mov_l:      jit_alu(j, ALU_MOV, 4, d->rd, d->rs, 0); break;
+        case OP_mov_b_imm:  jit_alu(j, ALU_MOV, 1, d->rd, -1, d->imm); break;
+        case OP_mov_w_imm:  jit_alu(j, ALU_MOV, 2, d->rd, -1, d->imm); break;
+        case OP_mov_l_imm:  jit_alu(j, ALU_MOV, 4, d->rd, -1, d->imm); break;
+        case OP_sub_b:      jit_alu(j, ALU_SUB, 1, d->rd, d->rs, 0); break;
+        case OP_sub_w:      jit_alu(j, ALU_SUB, 2, d->rd, d->rs, 0); break;
+        case OP_sub_l:      jit_alu(j, ALU_SUB, 4, d->rd, d->rs, 0); break;
+        case OP_sub_w_imm:  jit_alu(j, ALU_SUB, 2, d->rd, -1, d->imm); break;
+        case OP_cmp_b:      jit_alu(j, ALU_CMP, 1, d->rd, d->rs, 0); break;
+        case OP_cmp_w:      jit_alu(j, ALU_CMP, 2, d->rd, d->rs, 0); break;
+        case OP_cmp_l:      jit_alu(j, ALU_CMP, 4, d->rd, d->rs, 0); break;
+        case OP_cmp_b_imm:  jit_alu(j, ALU_CMP, 1, d->rd, -1, d->imm); break;
+        case OP_cmp_w_imm:  jit_alu(j, ALU_CMP, 2, d->rd, -1, d->imm); break;
+        case OP_cmp_l_imm:  jit_alu(j, ALU_CMP, 4, d->rd, -1, d->imm); break;
+        case OP_and_b:      jit_alu(j, ALU_AND, 1, d->rd, d->rs, 0); break;
+        case OP_and_w:      jit_alu(j, ALU_AND, 2, d->rd, d->rs, 0); break;
+        case OP_and_b_imm:  jit_alu(j, ALU_AND, 1, d->rd, -1, d->imm); break;
+        case OP_and_w_imm:  jit_alu(j, ALU_AND, 2, d->rd, -1, d->imm); break;
+        case OP_and_l_imm:  jit_alu(j, ALU_AND, 4, d->rd, -1, d->imm); break;
+        case OP_or_b:       jit_alu(j, ALU_OR,  1, d->rd, d->rs, 0); break;
+        case OP_or_w:       jit_alu(j, ALU_OR,  2, d->rd, d->rs, 0); break;
+        case OP_or_b_imm:   jit_alu(j, ALU_OR,  1, d->rd, -1, d->imm); break;
+        case OP_or_w_imm:   jit_alu(j, ALU_OR,  2, d->rd, -1, d->imm); break;
+        case OP_xor_b:      jit_alu(j, ALU_XOR, 1, d->rd, d->rs, 0); break;
+        case OP_xor_w:      jit_alu(j, ALU_XOR, 2, d->rd, d->rs, 0); break;
+        case OP_xor_b_imm:  jit_alu(j, ALU_XOR, 1, d->rd, -1, d->imm); break;
+        case OP_adds:       jit_add32(j, d->rd, d->imm); break;
+        case OP_subs:       jit_add32(j, d->rd, -d->imm); break;
+        case OP_inc_l:      jit_add32(j, d->rd, 1); break;
+        case OP_inc_w:
+            jit_mem(j, 0x6681, 0, reg16_off(d->rd));
+            jit_u16(j, d->imm);
+            break;
+        case OP_inc_b:
+            jit_mem(j, 0x80, 0, reg8_off(d->rd));
+            jit_u8(j, 1);
+            break;
+        case OP_mov_b_ld_ind:   mem = jit_mov_mem(b, d, addr, 1, 0, d->rs, 0); goto mem;
+        case OP_mov_b_st_ind:   mem = jit_mov_mem(b, d, addr, 1, 1, d->rd, 0); goto mem;
+        case OP_mov_w_ld_ind:   mem = jit_mov_mem(b, d, addr, 2, 0, d->rs, 0); goto mem;
+        case OP_mov_w_st_ind:   mem = jit_mov_mem(b, d, addr, 2, 1, d->rd, 0); goto mem;
+        case OP_mov_b_ld_disp:  mem = jit_mov_mem(b, d, addr, 1, 0, d->rs, d->imm); goto mem;
+        case OP_mov_b_st_disp:  mem = jit_mov_mem(b, d, addr, 1, 1, d->rd, d->imm); goto mem;
+        case OP_mov_w_ld_disp:  mem = jit_mov_mem(b, d, addr, 2, 0, d->rs, d->imm); goto mem;
+        case OP_mov_w_st_disp:  mem = jit_mov_mem(b, d, addr, 2, 1, d->rd, d->imm); goto mem;
+        case OP_mov_b_ld_abs8:
+        case OP_mov_b_ld_abs16: mem = jit_mov_mem(b, d, addr, 1, 0, -1, d->imm); goto mem;
+        case OP_mov_b_st_abs8:
+        case OP_mov_b_st_abs16: mem = jit_mov_mem(b, d, addr, 1, 1, -1, d->imm); goto mem;
+        case OP_mov_w_ld_abs16: mem = jit_mov_mem(b, d, addr, 2, 0, -1, d->imm); goto mem;
+        case OP_mov_w_st_abs16: mem = jit_mov_mem(b, d, addr, 2, 1, -1, d->imm); goto mem;
+        default:
+            return 0;
+    }
+    return 2 + fetch;
+
+mem:
+    return mem ? 2 + fetch + 2 : 0;
+}
+
+// Leaves the block to run a handler's instruction at run time
+static void jit_handler(jit_block_t *b, const pw_decoded_t *d, uint16_t addr) {
+    pw_jit_t *j = b->jit;
+    jit_set_ip(j, CTX_OFF(ip), addr);
+    jit_call(j, (uintptr_t)d->handler, d);
+}
+
+// The end of a step: prefetch states, count, and leave if events are due.
+// ip and prev_ip are only stored when leaving.
+static void jit_step(jit_block_t *b, uint16_t next, uint16_t addr) {
+    pw_jit_t *j = b->jit;
+    jit_u8(j, 0x49);
+    jit_rr(j, 0xFF, 0, 4);
+    jit_mem(j, 0x8B, RAX, CTX_OFF(states));
+    jit_mem(j, 0x3B, RAX, CTX_OFF(deadline));
+    jit_stub(b, STUB_EVENTS, jit_jump(j, JCC_GE), next, addr, NULL, NULL);
+}
+
+static void jit_add_states(pw_jit_t *j, int states) {
+    jit_mem(j, 0x81, 0, CTX_OFF(states));
+    jit_u32(j, states);
+}
+
+// Whether pw_run would go on from addr to target without bad_ip
+static int jit_chainable(uint16_t addr, uint32_t target) {
+    return target <= JIT_IP_MAX && !(target & 1) && target != addr;
+}
+
+// Jump to the block at target, through a stub until it is translated
+static void jit_chain(jit_block_t *b, uint16_t target, uint16_t addr) {
+    pw_jit_t *j = b->jit;
+    uint8_t *rel = jit_jump(j, JMP);
+    uint32_t off = j->map[target >> 1];
+    if (off != JIT_UNTRANSLATED && off != JIT_NO_BLOCK) {
+        jit_land(rel, j->code + off);
+    } else {
+        jit_stub(b, STUB_LINK, rel, target, addr, NULL, NULL);
+    }
+}
+
+static int jit_ends_block(enum pw_op op) {
+    switch (op) {
+        case OP_bcc_8:
+        case OP_bcc_16:
+        case OP_bsr_8:
+        case OP_bsr_16:
+        case OP_jmp_abs:
+        case OP_jsr_abs:
+        case OP_jmp_ind:
+        case OP_jsr_ind:
+        case OP_rts:
+        case OP_rte:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Instructions the interpreter keeps: the ones that don't move the ip the
+// usual way, and the ones pw_run would stop after
+static int jit_translatable(pw_context_t *ctx, uint16_t addr) {
+    const pw_decoded_t *d = &ctx->decode_cache[addr >> 1];
+    switch (d->op) {
+        case OP_unimpl:
+        case OP_jmp_mem:
+        case OP_jsr_mem:
+        case OP_mov_w_ld_abs24:
+            return 0;
+        default:
+            return addr + d->len <= JIT_IP_MAX;
+    }
+}
+
+// A branch handler ran. Static targets continue in their block, anything
+// else goes back to the loop.
+static void jit_branch(jit_block_t *b, const pw_decoded_t *d, uint16_t addr) {
+    pw_jit_t *j = b->jit;
+    uint32_t targets[2];
+    uint8_t *taken[2];
+    int n = 0;
+
+    switch (d->op) {
+        case OP_bcc_8:
+        case OP_bcc_16:
+            targets[n++] = (uint16_t)(addr + d->len);
+            // fall through
+        case OP_bsr_8:
+        case OP_bsr_16:
+        case OP_jmp_abs:
+        case OP_jsr_abs:
+            if (n == 0 || (uint16_t)d->imm != targets[0]) {
+                targets[n++] = (uint16_t)d->imm;
+            }
+            break;
+        default:
+            break;
+    }
+    jit_mem(j, 0x0FB7, RAX, CTX_OFF(ip));
+    for (int i = 0; i < n; i++) {
+        if (!jit_chainable(addr, targets[i])) {
+            taken[i] = NULL;
+            continue;
+        }
+        jit_u8(j, 0x3D);
+        jit_u32(j, targets[i]);
+        taken[i] = jit_jump(j, JCC_E);
+    }
+    jit_stub(b, STUB_NEXT, jit_jump(j, JMP), 0, addr, NULL, NULL);
+    for (int i = 0; i < n; i++) {
+        if (taken[i] == NULL) {
+            continue;
+        }
+        jit_land(taken[i], j->p);
+        jit_add_states(j, 2);
+        jit_step(b, targets[i], addr);
+        jit_chain(b, targets[i], addr);
+    }
+}
+
+static void jit_stubs(jit_block_t *b) {
+    pw_jit_t *j = b->jit;
+    for (int i = 0; i < b->num_stubs; i++) {
+        jit_stub_t *s = &b->stubs[i];
+        jit_land(s->rel, j->p);
+        switch (s->kind) {
+            case STUB_EVENTS:
+                jit_set_ip(j, CTX_OFF(ip), s->ip);
+                jit_set_ip(j, CTX_OFF(prev_ip), s->prev_ip);
+                jit_exit(j, JIT_EVENTS);
+                break;
+            case STUB_NEXT:
+                jit_set_ip(j, CTX_OFF(prev_ip), s->prev_ip);
+                jit_exit(j, JIT_NEXT);
+                break;
+            case STUB_SLOW:
+                jit_handler(b, s->d, s->ip);
+                jit_add_states(j, 2);
+                jit_land(jit_jump(j, JMP), s->resume);
+                break;
+            case STUB_LINK:
+                jit_set_ip(j, CTX_OFF(ip), s->ip);
+                jit_set_ip(j, CTX_OFF(prev_ip), s->prev_ip);
+                jit_exit(j, (uint32_t)(s->rel - j->code) << 2 | JIT_LINK);
+                break;
+        }
+    }
+}
+
+static void jit_flush(pw_jit_t *j) {
+    memset(j->map, 0, sizeof(j->map));
+    j->p = j->blocks;
+    j->flushes++;
+}
+
+// Translates the block starting at addr
+static const uint8_t *jit_translate(pw_context_t *ctx, uint16_t addr) {
+    pw_jit_t *j = ctx->jit;
+    jit_block_t b;
+    uint8_t *entry;
+
+    if (j->p + JIT_BLOCK_ROOM > j->code + JIT_CODE_SIZE) {
+        jit_flush(j);
+    }
+    b.jit = j;
+    b.num_stubs = 0;
+    entry = j->p;
+    // loops back to the start chain straight away
+    j->map[addr >> 1] = (uint32_t)(entry - j->code);
+    for (int n = 0; ; n++) {
+        const pw_decoded_t *d = &ctx->decode_cache[addr >> 1];
+        uint16_t next = addr + d->len;
+        int states;
+
+        if (jit_ends_block(d->op)) {
+            jit_handler(&b, d, addr);
+            jit_branch(&b, d, addr);
+            break;
+        }
+        int first_stub = b.num_stubs;
+        states = jit_template(&b, d, addr);
+        if (states == 0) {
+            jit_handler(&b, d, addr);
+            // the handler has to have moved on to the next instruction
+            jit_mem(j, 0x6681, 7, CTX_OFF(ip));
+            jit_u16(j, next);
+            jit_stub(&b, STUB_NEXT, jit_jump(j, JCC_NE), 0, addr, NULL, NULL);
+            states = 2;
+        }
+        jit_add_states(j, states);
+        for (int i = first_stub; i < b.num_stubs; i++) {
+            if (b.stubs[i].kind == STUB_SLOW) {
+                b.stubs[i].resume = j->p;
+            }
+        }
+        jit_step(&b, next, addr);
+        if (n + 1 == JIT_BLOCK_INSTRS || !jit_translatable(ctx, next)) {
+            jit_chain(&b, next, addr);
+            break;
+        }
+        addr = next;
+    }
+    jit_stubs(&b);
+    return entry;
+}
+
+// Code for the block at addr, NULL if it is left to the interpreter
+static const uint8_t *jit_block(pw_context_t *ctx, uint16_t addr) {
+    pw_jit_t *j = ctx->jit;
+    if ((addr & 1) || addr > JIT_IP_MAX) {
+        return NULL;
+    }
+    uint32_t off = j->map[addr >> 1];
+    if (off == JIT_NO_BLOCK) {
+        return NULL;
+    }
+    if (off != JIT_UNTRANSLATED) {
+        return j->code + off;
+    }
+    if (!jit_translatable(ctx, addr)) {
+        j->map[addr >> 1] = JIT_NO_BLOCK;
+        return NULL;
+    }
+    return jit_translate(ctx, addr);
+}
+
+// Runs translated code from ctx->ip for as long as there is some. Leaves
+// cur set up for the interpreter unless it returns JIT_NEXT.
+static enum jit_exit jit_run(pw_context_t *ctx, long *count) {
+    pw_jit_t *j = ctx->jit;
+    enum jit_exit ret = JIT_INTERP;
+    const uint8_t *code = jit_block(ctx, ctx->ip);
+
+    while (code != NULL) {
+        uint32_t status = j->enter(ctx, code, count);
+        ret = status & 3;
+        if (ret != JIT_LINK) {
+            break;
+        }
+        ret = JIT_INTERP;
+        uint32_t flushes = j->flushes;
+        code = jit_block(ctx, ctx->ip);
+        if (code != NULL && flushes == j->flushes) {
+            jit_land(j->code + (status >> 2), code);
+        }
+    }
+    if (ret != JIT_NEXT) {
+        ctx->cur = decode_at(ctx, ctx->ip);
+        ctx->instr_prefetch = ctx->cur->instr;
+    }
+    return ret;
+}
+
+static pw_jit_t *jit_create(void) {
+    pw_jit_t *j = calloc(1, sizeof(pw_jit_t));
+    if (j == NULL) {
+        return NULL;
+    }
+    j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (j->code == MAP_FAILED) {
+        free(j);
+        return NULL;
+    }
+    j->p = j->code;
+    j->enter = (jit_entry_t)(void *)j->p;
+    // push rbx and r12 to r15, which also aligns the stack for calls
+    jit_u8(j, 0x53);
+    jit_op(j, 0x4154);
+    jit_op(j, 0x4155);
+    jit_op(j, 0x4156);
+    jit_op(j, 0x4157);
+    jit_rr(j, 0x4889, RDI, RBX);
+    jit_rr(j, 0x4989, RDX, 5);
+    // mov r12, [r13]
+    jit_op(j, 0x4D8B);
+    jit_u8(j, 0x65);
+    jit_u8(j, 0x00);
+    jit_rr(j, 0xFF, 4, RSI);
+    // returns with the status in eax
+    j->leave = j->p;
+    jit_op(j, 0x4D89);
+    jit_u8(j, 0x65);
+    jit_u8(j, 0x00);
+    jit_op(j, 0x415F);
+    jit_op(j, 0x415E);
+    jit_op(j, 0x415D);
+    jit_op(j, 0x415C);
+    jit_u8(j, 0x5B);
+    jit_u8(j, 0xC3);
+    j->blocks = j->p;
+    return j;
+}
+
+static void jit_free(pw_jit_t *j) {
+    munmap(j->code, JIT_CODE_SIZE);
+    free(j);
+}
+#endif
+
+#ifdef PW_THREADED
+#define OP_LABEL(name) &&l_##name,
+#define THREADED_OP(name) l_##name: op_##name(ctx, d); goto next;
+
+static long pw_run(pw_context_t *ctx, int until) {
+    static void *const dispatch[NUM_OPS] = {
+        PW_OPS(OP_LABEL)
+    };
+    long count = 0;
+    uint16_t addr;
+    const pw_decoded_t *d;
+
+    if (ctx->states >= until) {
+        return 0;
+    }
+    ctx->run_until = until;
+    update_deadline(ctx);
+    if (pw_sleeping(ctx)) {
+        goto events;
+    }
+    goto start;
+
+    PW_OPS(THREADED_OP)
+
+next:
+    prefetch(ctx);
+    ctx->prev_ip = addr;
+    if (unlikely(addr == ctx->ip || ctx->ip > 0xBAC4)) {
+        bad_ip(ctx);
+        goto done;
+    }
+    count++;
+    if (unlikely(ctx->states >= ctx->deadline)) {
+        goto events;
+    }
+start:
+#ifdef PW_JIT
+    if (ctx->jit != NULL) {
+        switch (jit_run(ctx, &count)) {
+            case JIT_NEXT:
+                addr = ctx->prev_ip;
+                goto next;
+            case JIT_EVENTS:
+                goto events;
+            default:
+                break;
+        }
+    }
+#endif
+    addr = ctx->ip;
+    d = ctx->cur;
+    goto *dispatch[d->op];
+
+events:
+    for (;;) {
+        // events due by the end of the batch are handled before it ends,
+        // as the portable loop does, so results don't depend on batching
+        if (ctx->states >= ctx->deadline) {
+            run_events(ctx);
+        }
+        if (ctx->states >= until || ctx->halted) {
+            goto done;
+        }
+        if (!pw_sleeping(ctx)) {
+            break;
+        }
+        // nothing to execute until something wakes the CPU up
+        ctx->states = ctx->deadline;
+    }
+    goto start;
+
+done:
+    ctx->byte_access = 0;
+    ctx->word_access = 0;
+    ctx->internal_states = 0;
+    return count;
+}
+#else
+static long pw_run(pw_context_t *ctx, int until) {
+    long count = 0;
+    ctx->run_until = until;
+    update_deadline(ctx);
+    while (ctx->states < until && !ctx->halted) {
+        if (pw_sleeping(ctx)) {
+            // nothing to execute until something wakes the CPU up
+            ctx->states = ctx->deadline;
+        } else {
+            pw_step(ctx);
+            count++;
+        }
+        if (ctx->states >= ctx->deadline) {
+            run_events(ctx);
+        }
+    }
+    return count;
+}
+#endif
+
+
+void pw_set_clock(pw_context_t *ctx, int64_t base) {
+    ctx->clock_emulated = 1;
+    ctx->clock_base = base;
+}
+
+pw_context_t *pw_create(void) {
+    pw_context_t *ctx = calloc(1, sizeof(pw_context_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    mm_reg_map_init();
+    return ctx;
+}
+
+void pw_destroy(pw_context_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    pw_set_jit(ctx, 0);
+    pw_rom_free(ctx->own_rom);
+    free(ctx);
+}
+
+int pw_set_jit(pw_context_t *ctx, int enabled) {
+#ifdef PW_JIT
+    if (enabled && ctx->jit == NULL) {
+        ctx->jit = jit_create();
+    } else if (!enabled && ctx->jit != NULL) {
+        jit_free(ctx->jit);
+        ctx->jit = NULL;
+    }
+#endif
+    return ctx->jit != NULL;
+}
+
+// FNV-1a
+static uint32_t hash32(uint32_t h, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+#define HASH32_INIT 2166136261u
+
+struct pw_rom {
+    const uint8_t *data;
+    uint8_t *buf;
+    size_t mapped;
+    // one decode cache entry per ROM word
+    pw_decoded_t *decode_cache;
+    // hash32 of the image, identifies the ROM in snapshots and boot caches
+    uint32_t hash;
+};
+
+// Only the part up to ROM_end is ever read
+#define ROM_IMAGE_SIZE (ROM_end + 1)
+
+// Same as peek16, words past the end of the ROM read as 0
+static uint16_t rom_word(const uint8_t *data, uint32_t addr) {
+    return addr < ROM_IMAGE_SIZE - 1 ? (data[addr] << 8) | data[addr+1] : 0;
+}
+
+// The whole ROM is decoded and hashed up front, so instances running on
+// other threads only ever read the cache
+static int rom_decode(pw_rom_t *rom) {
+    rom->hash = hash32(HASH32_INIT, rom->data, ROM_IMAGE_SIZE);
+    rom->decode_cache = malloc(DECODE_CACHE_SIZE * sizeof(pw_decoded_t));
+    if (rom->decode_cache == NULL) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < DECODE_CACHE_SIZE; i++) {
+        uint32_t addr = i * 2;
+        decode(&rom->decode_cache[i], addr, rom_word(rom->data, addr),
+            rom_word(rom->data, addr+2), rom_word(rom->data, addr+4));
+    }
+    return 1;
+}
+
+pw_rom_t *pw_rom_create(const uint8_t *data, size_t size) {
+    if (size > PW_ROM_SIZE) {
+        return NULL;
+    }
+    pw_rom_t *rom = calloc(1, sizeof(pw_rom_t));
+    uint8_t *buf = malloc(ROM_IMAGE_SIZE);
+    if (rom == NULL || buf == NULL) {
+        free(rom);
+        free(buf);
+        return NULL;
+    }
+    memset(buf, 0xFF, ROM_IMAGE_SIZE);
+    memcpy(buf, data, size < ROM_IMAGE_SIZE ? size : ROM_IMAGE_SIZE);
+    rom->buf = buf;
+    rom->data = buf;
+    if (!rom_decode(rom)) {
+        pw_rom_free(rom);
+        return NULL;
+    }
+    return rom;
+}
+
+pw_rom_t *pw_rom_open(const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= ROM_IMAGE_SIZE) {
+        void *map = mmap(NULL, ROM_IMAGE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+        pw_rom_t *rom = calloc(1, sizeof(pw_rom_t));
+        if (rom == NULL) {
+            munmap(map, ROM_IMAGE_SIZE);
+            return NULL;
+        }
+        rom->data = map;
+        rom->mapped = ROM_IMAGE_SIZE;
+        if (!rom_decode(rom)) {
+            pw_rom_free(rom);
+            return NULL;
+        }
+        return rom;
+    }
+    close(fd);
+#endif
+    // short image or no mmap, fall back to a padded copy
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    uint8_t *data = malloc(PW_ROM_SIZE);
+    size_t size = data ? fread(data, 1, PW_ROM_SIZE, f) : 0;
+    fclose(f);
+    pw_rom_t *rom = data ? pw_rom_create(data, size) : NULL;
+    free(data);
+    return rom;
+}
+
+void pw_rom_free(pw_rom_t *rom) {
+    if (rom == NULL) {
+        return;
+    }
+#ifndef _WIN32
+    if (rom->mapped) {
+        munmap((void*)rom->data, rom->mapped);
+    }
+#endif
+    free(rom->decode_cache);
+    free(rom->buf);
+    free(rom);
+}
+
+void pw_set_rom(pw_context_t *ctx, const pw_rom_t *rom) {
+    if (ctx->own_rom != rom) {
+        pw_rom_free(ctx->own_rom);
+        ctx->own_rom = NULL;
+    }
+#ifdef PW_JIT
+    // translations point into the old ROM's decode cache
+    if (ctx->jit != NULL && ctx->decode_cache != rom->decode_cache) {
+        jit_flush(ctx->jit);
+    }
+#endif
+    ctx->rom = rom->data;
+    ctx->decode_cache = rom->decode_cache;
+    ctx->rom_hash = rom->hash;
+}
+
+int pw_load_rom(pw_context_t *ctx, const uint8_t *data, size_t size) {
+    pw_rom_t *rom = pw_rom_create(data, size);
+    if (rom == NULL) {
+        return 0;
+    }
+    pw_set_rom(ctx, rom);
+    ctx->own_rom = rom;
+    return 1;
+}
+
+int pw_load_eeprom(pw_context_t *ctx, const uint8_t *data, size_t size) {
+    if (size > sizeof(ctx->eeprom_data)) {
+        return 0;
+    }
+    memset(ctx->eeprom_data, 0xFF, sizeof(ctx->eeprom_data));
+    memcpy(ctx->eeprom_data, data, size);
+    return 1;
+}
+
+// Page shown on a row for the current start line
+#define VISIBLE_PAGE(lcd, y) ((((y) + (lcd)->display_start_line) / 8) % LCD_NUM_PAGES)
+
+int pw_poll_dirty(pw_context_t *ctx, int *first_row, int *num_rows) {
+    lcd_t *lcd = &ctx->lcd;
+    int first = -1, last = -1;
+    for (int y = 0; y < PW_SCREEN_HEIGHT; y++) {
+        if (lcd->dirty_pages & (1u << VISIBLE_PAGE(lcd, y))) {
+            if (first < 0) {
+                first = y;
+            }
+            last = y;
+        }
+    }
+    lcd->dirty_pages = 0;
+    if (first < 0) {
+        return 0;
+    }
+    *first_row = first;
+    *num_rows = last - first + 1;
+    return 1;
+}
+
+int pw_poll_redraw(pw_context_t *ctx) {
+    int first, rows;
+    return pw_poll_dirty(ctx, &first, &rows);
+}
+
+uint32_t pw_frame_hash(pw_context_t *ctx) {
+    lcd_t *lcd = &ctx->lcd;
+    uint32_t h = hash32(HASH32_INIT, &lcd->display_start_line, 1);
+    int prev = -1;
+    for (int y = 0; y < PW_SCREEN_HEIGHT; y++) {
+        int pg = VISIBLE_PAGE(lcd, y);
+        if (pg != prev) {
+            h = hash32(h, lcd->ram[pg], PW_SCREEN_WIDTH * 2);
+            prev = pg;
+        }
+    }
+    return h;
+}
+
+void pw_set_frame_callback(pw_context_t *ctx, pw_frame_callback_t cb, void *user) {
+    ctx->frame_cb = cb;
+    ctx->frame_cb_user = user;
+    ctx->frame_cb_version = ctx->lcd.version;
+    ctx->frame_cb_hash = pw_frame_hash(ctx);
+}
+
+// Tells the embedder about a new frame once the display shows something
+// else than at the last call
+static void check_frame_changed(pw_context_t *ctx) {
+    if (ctx->frame_cb == NULL || ctx->frame_cb_version == ctx->lcd.version) {
+        return;
+    }
+    ctx->frame_cb_version = ctx->lcd.version;
+    uint32_t h = pw_frame_hash(ctx);
+    if (h != ctx->frame_cb_hash) {
+        ctx->frame_cb_hash = h;
+        ctx->frame_cb(ctx, ctx->frame_cb_user);
+    }
+}
+
+long pw_run_states(pw_context_t *ctx, int states) {
+    // picks up whatever was queued since the last batch
+    input_apply(ctx);
+    long count = pw_run(ctx, states);
+    ctx->cycles += ctx->states;
+    ctx->states = 0;
+    check_frame_changed(ctx);
+    return count;
+}
+
+uint64_t pw_get_cycles(pw_context_t *ctx) {
+    return pw_now(ctx);
+}
+
+int pw_halted(pw_context_t *ctx) {
+    return ctx->halted;
+}
+
+int pw_is_sleeping(pw_context_t *ctx) {
+    return pw_sleeping(ctx);
+}
+
+uint64_t pw_next_wakeup(pw_context_t *ctx) {
+    uint64_t next = sched_next(&ctx->sched);
+    // inputs queued since the last run aren't scheduled yet
+    uint32_t tail = ctx->input_tail;
+    if (tail != load_acquire(&ctx->input_head)) {
+        uint64_t at = ctx->input_queue[tail % INPUT_QUEUE_SIZE].at;
+        if (at < next) {
+            next = at;
+        }
+    }
+    return next;
+}
+
+void pw_set_keys(pw_context_t *ctx, uint8_t keys) {
+    set_keys(ctx, keys);
+}
+
+int pw_queue_input(pw_context_t *ctx, uint64_t at, enum pw_input type, uint32_t value) {
+    // only the queueing thread writes input_head
+    uint32_t head = ctx->input_head;
+    if (head - load_acquire(&ctx->input_tail) == INPUT_QUEUE_SIZE) {
+        return 0;
+    }
+    pw_input_event_t *ev = &ctx->input_queue[head % INPUT_QUEUE_SIZE];
+    ev->at = at;
+    ev->type = type;
+    ev->value = value;
+    store_release(&ctx->input_head, head + 1);
+    return 1;
+}
+
+// Moves bit n of a byte to bit 2n
+static inline uint32_t spread_bits(uint32_t v) {
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+
+void pw_get_framebuffer_rows(pw_context_t *ctx, uint32_t *pixels, int pitch, int first_row, int num_rows) {
+    lcd_t *lcd = &ctx->lcd;
+    // int32_t palette[4];
+    // {
+    //     int32_t white = colors[0];
+    //     int wr = (white >> 16) & 0xFF;
+    //     int wg = (white >> 8) & 0xFF;
+    //     int wb = white & 0xFF;
+    //     palette[0] = white;
+    //     for (int i = 1; i < 4; i++) {
+    //         int32_t col = colors[i];
+    //         int r = (col >> 16) & 0xFF;
+    //         int g = (col >> 8) & 0xFF;
+    //         int b = col & 0xFF;
+    //         palette[i] = RGBA(
+    //             wr + (int) ((r - wr) * (lcd.contrast / 32.0)), 
+    //             wg + (int) ((g - wg) * (lcd.contrast / 32.0)), 
+    //             wb + (int) ((b - wb) * (lcd.contrast / 32.0)), 
+    //             255
+    //         );
+    //     }
+    // }
+    // every page holds 8 rows, each column as two bit planes: the first
+    // byte has the high bit of each pixel, the second the low bit
+    int y = first_row;
+    int end = first_row + num_rows;
+    // pixels points at the first row
+    pixels = (uint32_t*)((uint8_t*)pixels - first_row * pitch);
+    while (y < end) {
+        int yo   = y + lcd->display_start_line;
+        const uint8_t *ram = lcd->ram[(yo / 8) % LCD_NUM_PAGES];
+        int bit  = yo % 8;
+        int rows = 8 - bit;
+        if (rows > end - y) {
+            rows = end - y;
+        }
+        // row n of the page ends up in bits 2n+1..2n
+        uint16_t pairs[PW_SCREEN_WIDTH];
+        for (int x = 0; x < PW_SCREEN_WIDTH; x++) {
+            pairs[x] = ((spread_bits(ram[x*2]) << 1) | spread_bits(ram[x*2+1])) >> (bit * 2);
+        }
+        for (int r = 0; r < rows; r++, y++) {
+            uint32_t *row = (uint32_t*)((uint8_t*)pixels + y * pitch);
+            for (int x = 0; x < PW_SCREEN_WIDTH; x++) {
+                row[x] = colors[(pairs[x] >> (r * 2)) & 3];
+            }
+        }
+    }
+}
+
+void pw_get_framebuffer(pw_context_t *ctx, uint32_t *pixels, int pitch) {
+    pw_get_framebuffer_rows(ctx, pixels, pitch, 0, PW_SCREEN_HEIGHT);
+}
+
+const uint8_t *pw_get_eeprom(pw_context_t *ctx) {
+    return ctx->eeprom_data;
+}
+
+void pw_print_vectors(pw_context_t *ctx) {
+    for(int i = 0; i < NUM_INTERRUPT_SOURCES; i++) {
+        uint16_t addr = peek16(ctx, i*2);
+        int imm_rte = addr != 0xffff && peek16(ctx, addr) == 0x5670;
+        printf("[%2d] %-18s: %.4x%s\n", i, int_names[i], addr, imm_rte ? " [RTE]" : "");
+    }
+}
+
+// Snapshots hold the EEPROM, RAM and every field of the machine state,
+// each stored explicitly at a fixed width in little endian order. Host
+// pointers are never stored, they are rebuilt on load. The ROM is left out
+// and only identified by its hash, so loading needs an instance with the
+// same ROM attached.
+//
+// The same walk over the state saves, loads and sizes a snapshot. Bump
+// SNAPSHOT_VERSION whenever it changes. The header also carries a hash of
+// the field widths in walk order, which catches most changes that were
+// made without a bump.
+#define SNAPSHOT_MAGIC   0x4E535750 // "PWSN"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 20
+
+typedef struct snap {
+    uint8_t *out;       // saving
+    const uint8_t *in;  // loading
+    size_t size;        // bytes walked so far
+    uint32_t layout;    // hash of the field widths
+} snap_t;
+
+static void snap_field(snap_t *s, uint8_t *bytes, size_t n) {
+    uint8_t width[4] = {(uint8_t)n, (uint8_t)(n >> 8), (uint8_t)(n >> 16), (uint8_t)(n >> 24)};
+    s->layout = hash32(s->layout, width, sizeof(width));
+    if (s->out != NULL) {
+        memcpy(s->out + s->size, bytes, n);
+    } else if (s->in != NULL) {
+        memcpy(bytes, s->in + s->size, n);
+    }
+    s->size += n;
+}
+
+static void snap_bytes(snap_t *s, void *data, size_t n) {
+    snap_field(s, data, n);
+}
+
+static uint64_t snap_uint(snap_t *s, uint64_t v, int n) {
+    uint8_t b[8];
+    for (int i = 0; i < n; i++) {
+        b[i] = (uint8_t)(v >> (8 * i));
+    }
+    snap_field(s, b, n);
+    v = 0;
+    for (int i = 0; i < n; i++) {
+        v |= (uint64_t)b[i] << (8 * i);
+    }
+    return v;
+}
+
+static void snap_u8(snap_t *s, uint8_t *v) {
+    *v = (uint8_t)snap_uint(s, *v, 1);
+}
+
+static void snap_u16(snap_t *s, uint16_t *v) {
+    *v = (uint16_t)snap_uint(s, *v, 2);
+}
+
+static void snap_u32(snap_t *s, uint32_t *v) {
+    *v = (uint32_t)snap_uint(s, *v, 4);
+}
+
+static void snap_u64(snap_t *s, uint64_t *v) {
+    *v = snap_uint(s, *v, 8);
+}
+
+static void snap_int(snap_t *s, int *v) {
+    *v = (int32_t)(uint32_t)snap_uint(s, (uint32_t)*v, 4);
+}
+
+// enums are stored as a byte
+#define snap_enum(s, v) do { uint8_t e_ = (uint8_t)*(v); snap_u8(s, &e_); *(v) = e_; } while (0)
+
+static void snap_rtc(snap_t *s, rtc_t *rtc) {
+    snap_u8(s, &rtc->rtccr1);
+    snap_u8(s, &rtc->rtccr2);
+    snap_u8(s, &rtc->rtccsr);
+    snap_u8(s, &rtc->rtcflg);
+    snap_int(s, &rtc->time.tm_sec);
+    snap_int(s, &rtc->time.tm_min);
+    snap_int(s, &rtc->time.tm_hour);
+    snap_int(s, &rtc->time.tm_mday);
+    snap_int(s, &rtc->time.tm_mon);
+    snap_int(s, &rtc->time.tm_year);
+    snap_int(s, &rtc->time.tm_wday);
+    snap_int(s, &rtc->time.tm_yday);
+    snap_int(s, &rtc->time.tm_isdst);
+    snap_u8(s, &rtc->pending_ints);
+    snap_int(s, &rtc->emulated);
+    int64_t base = rtc->base;
+    base = (int64_t)snap_uint(s, (uint64_t)base, 8);
+    rtc->base = (time_t)base;
+    snap_u64(s, &rtc->seconds);
+}
+
+static void snap_lcd(snap_t *s, lcd_t *lcd) {
+    snap_u8(s, &lcd->page_address);
+    snap_u8(s, &lcd->column_address);
+    snap_u8(s, &lcd->display_on);
+    snap_u8(s, &lcd->display_start_line);
+    snap_u8(s, &lcd->display_offset);
+    snap_u8(s, &lcd->mux_ratio);
+    snap_u8(s, &lcd->entire_display_on);
+    snap_u8(s, &lcd->contrast);
+    snap_u8(s, &lcd->segment_remap);
+    snap_u8(s, &lcd->upper_window_corner_x);
+    snap_u8(s, &lcd->upper_window_corner_y);
+    snap_u8(s, &lcd->lower_window_corner_x);
+    snap_u8(s, &lcd->lower_window_corner_y);
+    snap_bytes(s, lcd->buf, sizeof(lcd->buf));
+    snap_u8(s, &lcd->buf_off);
+    snap_bytes(s, lcd->ram, sizeof(lcd->ram));
+    // dirty_pages and version only track what the frontend has seen, a
+    // load invalidates the whole display instead
+}
+
+static void snap_sched(snap_t *s, sched_t *sched) {
+    // the heap order is kept as is, so events due at the same time are
+    // still handled in the same order after a load
+    for (int i = 0; i < NUM_SCHED_EVENTS; i++) {
+        snap_u64(s, &sched->when[i]);
+    }
+    snap_bytes(s, sched->heap, sizeof(sched->heap));
+    snap_bytes(s, sched->pos, sizeof(sched->pos));
+    snap_int(s, &sched->size);
+}
+
+static void snapshot_walk(snap_t *s, pw_context_t *ctx) {
+    snap_bytes(s, ctx->eeprom_data, PW_EEPROM_SIZE);
+    snap_bytes(s, ctx->ram, sizeof(ctx->ram));
+
+    // CPU
+    for (int i = 0; i < 16; i++) {
+        snap_u16(s, &ctx->regs[i]);
+    }
+    snap_u8(s, &ctx->ccr);
+    snap_enum(s, &ctx->flags_op);
+    snap_u32(s, &ctx->flags_a);
+    snap_u32(s, &ctx->flags_b);
+    snap_u32(s, &ctx->flags_res);
+    snap_u16(s, &ctx->ip);
+    snap_u16(s, &ctx->instr_prefetch);
+    snap_u16(s, &ctx->prev_ip);
+    snap_int(s, &ctx->halted);
+    snap_enum(s, &ctx->mode);
+    snap_int(s, &ctx->int_enabled);
+
+    // on-chip peripherals
+    snap_u8(s, &ctx->pdr1);
+    snap_u8(s, &ctx->pdr9);
+    snap_u8(s, &ctx->iegr);
+    snap_u8(s, &ctx->ienr1);
+    snap_u8(s, &ctx->ienr2);
+    snap_u8(s, &ctx->irr1);
+    snap_u8(s, &ctx->irr2);
+    snap_u8(s, &ctx->pfcr);
+    snap_u8(s, &ctx->syscr1);
+    snap_u8(s, &ctx->syscr2);
+    snap_u8(s, &ctx->osccr);
+    snap_u8(s, &ctx->ckstpr1);
+    snap_u8(s, &ctx->ckstpr2);
+    snap_u8(s, &ctx->tmb1);
+    snap_u8(s, &ctx->tcb1);
+    snap_u8(s, &ctx->tlb1);
+    snap_u8(s, &ctx->tmrw);
+    snap_u8(s, &ctx->tcrw);
+    snap_u8(s, &ctx->tierw);
+    snap_u8(s, &ctx->tsrw);
+    snap_u8(s, &ctx->tior0);
+    snap_u8(s, &ctx->tior1);
+    snap_u16(s, &ctx->tcnt);
+    snap_u16(s, &ctx->gra);
+    snap_u16(s, &ctx->grb);
+    snap_u16(s, &ctx->grc);
+    snap_u16(s, &ctx->grd);
+    snap_u8(s, &ctx->tmrw_rem);
+    snap_u64(s, &ctx->tmrw_synced);
+    snap_u8(s, &ctx->rdr);
+    snap_u8(s, &ctx->tdr);
+    snap_u8(s, &ctx->smr);
+    snap_u8(s, &ctx->scr);
+    snap_u8(s, &ctx->ssr);
+    snap_u8(s, &ctx->brr);
+    snap_u8(s, &ctx->ircr);
+    snap_u8(s, &ctx->semr);
+
+    // SSU and the devices behind it, the callbacks follow from ssu_target
+    snap_u8(s, &ctx->ssu.sscrh);
+    snap_u8(s, &ctx->ssu.sscrl);
+    snap_u8(s, &ctx->ssu.ssmr);
+    snap_u8(s, &ctx->ssu.sser);
+    snap_u8(s, &ctx->ssu.sssr);
+    snap_u8(s, &ctx->ssu.ssrdr);
+    snap_u8(s, &ctx->ssu.sstdr);
+    snap_u8(s, &ctx->ssu.sstrsr);
+    snap_enum(s, &ctx->ssu_target);
+    snap_bytes(s, ctx->eeprom.buf, sizeof(ctx->eeprom.buf));
+    snap_int(s, &ctx->eeprom.buf_off);
+    snap_u8(s, &ctx->eeprom.next_read);
+    snap_lcd(s, &ctx->lcd);
+    snap_u8(s, &ctx->accel.read_mode);
+    snap_u8(s, &ctx->accel.addr);
+    snap_int(s, &ctx->accel.count);
+    snap_u8(s, &ctx->accel.next_read);
+    snap_rtc(s, &ctx->rtc);
+    snap_u8(s, &ctx->portb.pmrb);
+    snap_u8(s, &ctx->portb.pdrb);
+    snap_u8(s, &ctx->keys_pressed);
+
+    // time
+    snap_int(s, &ctx->states);
+    snap_u64(s, &ctx->cycles);
+    snap_sched(s, &ctx->sched);
+}
+
+// Only the addresses of its fields are used, to size snapshots
+static pw_context_t snapshot_probe;
+
+static snap_t snapshot_format(void) {
+    snap_t s = {NULL, NULL, 0, HASH32_INIT};
+    snapshot_walk(&s, &snapshot_probe);
+    return s;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t pw_snapshot_size(void) {
+    return SNAPSHOT_HEADER_SIZE + snapshot_format().size;
+}
+
+void pw_snapshot_save(pw_context_t *ctx, uint8_t *buf) {
+    snap_t s = {buf + SNAPSHOT_HEADER_SIZE, NULL, 0, HASH32_INIT};
+    snapshot_walk(&s, ctx);
+
+    put32(buf, SNAPSHOT_MAGIC);
+    put32(buf + 4, SNAPSHOT_VERSION);
+    put32(buf + 8, (uint32_t)s.size);
+    put32(buf + 12, s.layout);
+    put32(buf + 16, ctx->rom_hash);
+}
+
+int pw_snapshot_load(pw_context_t *ctx, const uint8_t *buf, size_t size) {
+    snap_t format = snapshot_format();
+    if (size != SNAPSHOT_HEADER_SIZE + format.size ||
+        get32(buf) != SNAPSHOT_MAGIC || get32(buf + 4) != SNAPSHOT_VERSION ||
+        get32(buf + 8) != format.size || get32(buf + 12) != format.layout ||
+        get32(buf + 16) != ctx->rom_hash) {
+        return 0;
+    }
+
+    snap_t s = {NULL, buf + SNAPSHOT_HEADER_SIZE, 0, HASH32_INIT};
+    memset(&ctx->rtc.time, 0, sizeof(ctx->rtc.time));
+    snapshot_walk(&s, ctx);
+
+    ctx->eeprom.mem = ctx->eeprom_data;
+    lcd_invalidate(&ctx->lcd);
+    ssu_select(ctx, ctx->ssu_target);
+    memmap_init(ctx);
+    ctx->cur = decode_at(ctx, ctx->ip);
+    ctx->run_until = 0;
+    update_deadline(ctx);
+    return 1;
+}
+
+uint32_t pw_image_hash(pw_context_t *ctx) {
+    return hash32(ctx->rom_hash, ctx->eeprom_data, PW_EEPROM_SIZE);
+}
+
+// Longest the ROM gets to initialise before the boot state is taken anyway
+#define BOOT_MAX_STATES (10 * PW_STATES_PER_SECOND)
+#define BOOT_SLICE_STATES (PW_STATES_PER_SECOND / 100)
+
+static void boot_cache_path(pw_context_t *ctx, const char *dir, char *path, size_t size) {
+    // one file per snapshot format, so builds that disagree on it don't keep
+    // replacing each other's cache
+    snprintf(path, size, "%s/boot-v%d-%08x-%08x.state", dir, SNAPSHOT_VERSION,
+             ctx->rom_hash,
+             hash32(HASH32_INIT, ctx->eeprom_data, PW_EEPROM_SIZE));
+}
+
+int pw_boot(pw_context_t *ctx, const char *cache_dir) {
+    char path[1024], tmp_path[1024 + 64];
+    size_t size = pw_snapshot_size();
+    uint8_t *buf = malloc(size);
+    int cached = 0;
+
+    pw_reset(ctx);
+    if (buf == NULL) {
+        return 0;
+    }
+    boot_cache_path(ctx, cache_dir, path, sizeof(path));
+
+    FILE *f = fopen(path, "rb");
+    if (f != NULL) {
+        cached = fread(buf, 1, size, f) == size && pw_snapshot_load(ctx, buf, size);
+        fclose(f);
+        if (cached) {
+            free(buf);
+            return 1;
+        }
+        // stale or from another build, boot and replace it
+        pw_reset(ctx);
+    }
+
+    // the ROM is done initialising once it first goes to sleep
+    while (ctx->cycles < BOOT_MAX_STATES && !ctx->halted) {
+        pw_run_states(ctx, BOOT_SLICE_STATES);
+        if (pw_sleeping(ctx)) {
+            break;
+        }
+    }
+    if (ctx->halted) {
+        free(buf);
+        return 0;
+    }
+
+    // write under a name private to this process and instance first, so
+    // concurrent boots never see half a file
+    pw_snapshot_save(ctx, buf);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%p", path, (long)getpid(), (void*)ctx);
+    f = fopen(tmp_path, "wb");
+    if (f != NULL) {
+        int ok = fwrite(buf, 1, size, f) == size;
+        ok &= fclose(f) == 0;
+        if (!ok || rename(tmp_path, path) != 0) {
+            remove(tmp_path);
+        }
+    }
+    free(buf);
+    return 0;
+}
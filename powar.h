@@ -0,0 +1,165 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Public interface of the emulator core. Frontends and harnesses only
+// need this header and libpowar, the machine itself is opaque.
+
+#define PW_SCREEN_WIDTH  96
+#define PW_SCREEN_HEIGHT 64
+#define PW_ROM_SIZE      (1 << 16)
+#define PW_EEPROM_SIZE   (1 << 16)
+
+// CPU clock, in states per emulated second
+#define PW_STATES_PER_SECOND 1600000
+
+// Port B bits of the three buttons
+enum pw_keys {
+    PW_KEY_ENTER = (1 << 0),
+    PW_KEY_LEFT  = (1 << 2),
+    PW_KEY_RIGHT = (1 << 4),
+};
+
+typedef struct pw_context pw_context_t;
+
+// Read-only ROM image that any number of instances can share. It has to
+// outlive every instance it is attached to.
+typedef struct pw_rom pw_rom_t;
+
+pw_rom_t *pw_rom_create(const uint8_t *data, size_t size);
+// maps the file instead of copying it where the platform allows
+pw_rom_t *pw_rom_open(const char *path);
+void pw_rom_free(pw_rom_t *rom);
+
+pw_context_t *pw_create(void);
+void pw_destroy(pw_context_t *ctx);
+
+// Attach a shared ROM, call before pw_reset
+void pw_set_rom(pw_context_t *ctx, const pw_rom_t *rom);
+
+// Both return 1 on success, 0 if the image is too large. pw_load_rom
+// gives the instance a private copy of the ROM.
+int pw_load_rom(pw_context_t *ctx, const uint8_t *data, size_t size);
+int pw_load_eeprom(pw_context_t *ctx, const uint8_t *data, size_t size);
+
+// Drives the RTC from emulated time instead of the host clock, starting
+// at base at reset. base counts seconds like a Unix time but is taken as
+// the walker's local time. Call before pw_reset.
+void pw_set_clock(pw_context_t *ctx, int64_t base);
+
+// Runs ROM code translated to native code instead of interpreting it, on
+// x86-64 builds of the threaded interpreter. Results are the same either
+// way. Returns whether translation is on, it stays off where it isn't
+// available.
+int pw_set_jit(pw_context_t *ctx, int enabled);
+
+// Runs the reset sequence, call after loading the images
+void pw_reset(pw_context_t *ctx);
+
+// Runs for at least the given number of states, returns the number of
+// instructions executed
+long pw_run_states(pw_context_t *ctx, int states);
+
+// States executed since reset
+uint64_t pw_get_cycles(pw_context_t *ctx);
+
+// Set when the CPU went somewhere it can't come back from
+int pw_halted(pw_context_t *ctx);
+
+// Set while the CPU waits for an interrupt in a sleep, standby or watch
+// mode. Until pw_next_wakeup nothing but an input queued later can wake
+// it, so a frontend can leave the instance alone until then.
+int pw_is_sleeping(pw_context_t *ctx);
+// Cycle of the next scheduled event or queued input, UINT64_MAX if there
+// is none. Only call from the thread running the instance.
+uint64_t pw_next_wakeup(pw_context_t *ctx);
+
+void pw_set_keys(pw_context_t *ctx, uint8_t keys);
+
+enum pw_input {
+    PW_INPUT_KEYS, // value is the enum pw_keys mask
+};
+
+// Queues an input to be applied once emulated time reaches the cycle at,
+// or at the start of the next pw_run_states if that already passed.
+// Inputs must be queued in order. One thread may queue while another runs
+// the instance, without locking. Returns 0 if the queue is full.
+int pw_queue_input(pw_context_t *ctx, uint64_t at, enum pw_input type, uint32_t value);
+
+// Returns whether the display changed since the last call. pw_poll_dirty
+// also gives the range of rows that changed; both reset the same state.
+int pw_poll_redraw(pw_context_t *ctx);
+int pw_poll_dirty(pw_context_t *ctx, int *first_row, int *num_rows);
+
+// Hash of what the display shows, for telling frames apart cheaply
+uint32_t pw_frame_hash(pw_context_t *ctx);
+
+// Called at the end of pw_run_states whenever the display shows a
+// different frame than at the previous call
+typedef void (*pw_frame_callback_t)(pw_context_t *ctx, void *user);
+void pw_set_frame_callback(pw_context_t *ctx, pw_frame_callback_t cb, void *user);
+
+// Converts the visible part of the LCD to ARGB8888, pitch is in bytes
+void pw_get_framebuffer(pw_context_t *ctx, uint32_t *pixels, int pitch);
+// Same for a range of rows only, pixels points at the first of them
+void pw_get_framebuffer_rows(pw_context_t *ctx, uint32_t *pixels, int pitch, int first_row, int num_rows);
+
+const uint8_t *pw_get_eeprom(pw_context_t *ctx);
+
+void pw_print_vectors(pw_context_t *ctx);
+
+// Whole machine state except the ROM, in a versioned format that doesn't
+// depend on the host or the build. Only call between pw_run_states calls;
+// loading needs the same ROM to be attached already.
+size_t pw_snapshot_size(void);
+// buf must hold pw_snapshot_size() bytes
+void pw_snapshot_save(pw_context_t *ctx, uint8_t *buf);
+// Returns 1 on success, 0 if the snapshot has another format version or
+// was taken with another ROM
+int pw_snapshot_load(pw_context_t *ctx, const uint8_t *buf, size_t size);
+
+// Replaces pw_reset when a boot state cache is wanted. Resumes from the
+// state cached in cache_dir for this ROM and EEPROM if there is one,
+// otherwise runs the reset sequence until the ROM first sleeps and caches
+// the result. Returns 1 if the state came from the cache.
+int pw_boot(pw_context_t *ctx, const char *cache_dir);
+
+// Rewind buffer holding up to capacity + 1 snapshots. Only the newest is
+// kept in full, older ones are stored as compressed deltas.
+typedef struct pw_rewind pw_rewind_t;
+
+pw_rewind_t *pw_rewind_create(int capacity);
+void pw_rewind_free(pw_rewind_t *rw);
+void pw_rewind_clear(pw_rewind_t *rw);
+// Takes a snapshot, dropping the oldest one when full
+void pw_rewind_push(pw_rewind_t *rw, pw_context_t *ctx);
+// Restores the newest snapshot, then each older one on further calls
+// until only the oldest is left. Returns 0 if there was nothing to restore.
+int pw_rewind_step_back(pw_rewind_t *rw, pw_context_t *ctx);
+// Number of snapshots held
+int pw_rewind_depth(pw_rewind_t *rw);
+// Bytes used for snapshot data
+size_t pw_rewind_memory(pw_rewind_t *rw);
+
+// Hash of the ROM and EEPROM images as they are now
+uint32_t pw_image_hash(pw_context_t *ctx);
+
+// Input movies, for runs that replay bit for bit. Both calls put the RTC
+// on the emulated clock and reset the instance, which must have its ROM
+// and EEPROM loaded. A movie stays bound to the instance it was opened on.
+typedef struct pw_movie pw_movie_t;
+
+pw_movie_t *pw_movie_record(const char *path, pw_context_t *ctx, int64_t clock_base);
+// Fails if the movie was recorded with other images
+pw_movie_t *pw_movie_play(const char *path, pw_context_t *ctx);
+// Use instead of pw_set_keys while recording
+void pw_movie_set_keys(pw_movie_t *m, uint8_t keys);
+// Use instead of pw_run_states. When replaying, inputs are applied at the
+// cycles they were recorded at and the run stops at the end of the movie.
+long pw_movie_run(pw_movie_t *m, int states);
+// Set once replay reached the end of the movie
+int pw_movie_done(pw_movie_t *m);
+// Set if replay couldn't stop at the cycle of an input
+int pw_movie_desynced(pw_movie_t *m);
+// Ends the recording, returns 0 if the file couldn't be written
+int pw_movie_close(pw_movie_t *m);
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "powar.h"
+
+// Rewind buffer. The newest snapshot is kept in full, every older one as
+// the difference to the snapshot after it: the XOR of both, run length
+// encoded. Between two snapshots only a small part of RAM, EEPROM and LCD
+// RAM changes, so the XOR is mostly zero runs. Stepping back applies a
+// single delta to the full copy, and dropping the oldest snapshot is just
+// freeing its delta.
+
+// zero runs shorter than this are kept inside the literal
+#define MIN_ZERO_RUN 8
+
+typedef struct delta {
+    uint8_t *data;
+    size_t size;
+} delta_t;
+
+struct pw_rewind {
+    size_t state_size;
+    uint8_t *cur;     // newest snapshot
+    uint8_t *next;    // scratch for the one being taken
+    uint8_t *encoded; // scratch for encoding, big enough for the worst case
+    int have_cur;
+    int restored;     // cur was the last state loaded
+
+    // ring of deltas, oldest at head
+    delta_t *deltas;
+    int capacity;
+    int head;
+    int count;
+    size_t delta_bytes;
+};
+
+static uint8_t *put_varint(uint8_t *p, size_t v) {
+    while (v >= 0x80) {
+        *p++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, size_t *v) {
+    int shift = 0;
+    *v = 0;
+    do {
+        *v |= (size_t)(*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+static size_t zero_run(const uint8_t *a, const uint8_t *b, size_t i, size_t size) {
+    size_t n = 0;
+    while (i + n < size && a[i + n] == b[i + n]) {
+        n++;
+    }
+    return n;
+}
+
+// Encodes a ^ b as records of <zero run> <literal length> <literal>
+static size_t delta_encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out) {
+    uint8_t *p = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t skip = zero_run(a, b, i, size);
+        i += skip;
+        if (i == size) {
+            break;
+        }
+        size_t start = i;
+        while (i < size) {
+            size_t run = zero_run(a, b, i, size);
+            if (run >= MIN_ZERO_RUN || i + run == size) {
+                break;
+            }
+            i += run + 1;
+        }
+        p = put_varint(p, skip);
+        p = put_varint(p, i - start);
+        for (size_t j = start; j < i; j++) {
+            *p++ = a[j] ^ b[j];
+        }
+    }
+    return p - out;
+}
+
+static void delta_apply(uint8_t *state, const uint8_t *data, size_t size) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    size_t i = 0;
+
+    while (p < end) {
+        size_t skip, len;
+        p = get_varint(p, &skip);
+        p = get_varint(p, &len);
+        i += skip;
+        for (size_t j = 0; j < len; j++) {
+            state[i++] ^= *p++;
+        }
+    }
+}
+
+pw_rewind_t *pw_rewind_create(int capacity) {
+    pw_rewind_t *rw = calloc(1, sizeof(pw_rewind_t));
+    if (rw == NULL) {
+        return NULL;
+    }
+    rw->state_size = pw_snapshot_size();
+    rw->cur = malloc(rw->state_size);
+    rw->next = malloc(rw->state_size);
+    // every record covers at least one literal byte plus MIN_ZERO_RUN
+    // zeros, so encoding never grows past twice the input
+    rw->encoded = malloc(2 * rw->state_size + 16);
+    rw->deltas = calloc(capacity, sizeof(delta_t));
+    rw->capacity = capacity;
+    if (rw->cur == NULL || rw->next == NULL || rw->encoded == NULL || rw->deltas == NULL) {
+        pw_rewind_free(rw);
+        return NULL;
+    }
+    return rw;
+}
+
+void pw_rewind_free(pw_rewind_t *rw) {
+    if (rw == NULL) {
+        return;
+    }
+    pw_rewind_clear(rw);
+    free(rw->cur);
+    free(rw->next);
+    free(rw->encoded);
+    free(rw->deltas);
+    free(rw);
+}
+
+void pw_rewind_clear(pw_rewind_t *rw) {
+    for (int i = 0; i < rw->count; i++) {
+        free(rw->deltas[(rw->head + i) % rw->capacity].data);
+    }
+    rw->head = 0;
+    rw->count = 0;
+    rw->delta_bytes = 0;
+    rw->have_cur = 0;
+    rw->restored = 0;
+}
+
+void pw_rewind_push(pw_rewind_t *rw, pw_context_t *ctx) {
+    rw->restored = 0;
+    if (!rw->have_cur) {
+        pw_snapshot_save(ctx, rw->cur);
+        rw->have_cur = 1;
+        return;
+    }
+
+    pw_snapshot_save(ctx, rw->next);
+    if (rw->capacity > 0) {
+        delta_t *d;
+        if (rw->count == rw->capacity) {
+            // forget the oldest snapshot
+            d = &rw->deltas[rw->head];
+            rw->delta_bytes -= d->size;
+            free(d->data);
+            rw->head = (rw->head + 1) % rw->capacity;
+            rw->count--;
+        }
+        d = &rw->deltas[(rw->head + rw->count) % rw->capacity];
+        d->size = delta_encode(rw->cur, rw->next, rw->state_size, rw->encoded);
+        d->data = malloc(d->size ? d->size : 1);
+        if (d->data != NULL) {
+            memcpy(d->data, rw->encoded, d->size);
+            rw->delta_bytes += d->size;
+            rw->count++;
+        } else {
+            // out of memory, history before this point is lost
+            pw_rewind_clear(rw);
+            rw->have_cur = 1;
+        }
+    }
+
+    uint8_t *tmp = rw->cur;
+    rw->cur = rw->next;
+    rw->next = tmp;
+}
+
+int pw_rewind_step_back(pw_rewind_t *rw, pw_context_t *ctx) {
+    if (!rw->have_cur) {
+        return 0;
+    }
+    if (rw->restored && rw->count > 0) {
+        delta_t *d = &rw->deltas[(rw->head + rw->count - 1) % rw->capacity];
+        delta_apply(rw->cur, d->data, d->size);
+        rw->delta_bytes -= d->size;
+        free(d->data);
+        rw->count--;
+    }
+    rw->restored = 1;
+    return pw_snapshot_load(ctx, rw->cur, rw->state_size);
+}
+
+int pw_rewind_depth(pw_rewind_t *rw) {
+    return rw->have_cur ? rw->count + 1 : 0;
+}
+
+size_t pw_rewind_memory(pw_rewind_t *rw) {
+    return rw->state_size * 3 + rw->delta_bytes;
+}
@@ -16,17 +16,46 @@ static uint32_t bcd(uint32_t val) {
     return (high << 4) | low;
 }
 
+// localtime() returns a shared buffer, use the reentrant variants so
+// several instances can run on different threads. The emulated clock is
+// already local time, so it's converted without a time zone to give the
+// same result on every host.
+static void local_time(rtc_t *rtc, struct tm *out) {
+    if (rtc->emulated) {
+        time_t t = rtc->base + (time_t)rtc->seconds;
+#ifdef _WIN32
+        gmtime_s(out, &t);
+#else
+        gmtime_r(&t, out);
+#endif
+        return;
+    }
+    time_t t = time(NULL);
+#ifdef _WIN32
+    localtime_s(out, &t);
+#else
+    localtime_r(&t, out);
+#endif
+}
+
 void rtc_init(rtc_t *rtc) {
     memset(rtc, 0, sizeof(rtc_t));
 }
 
-void rtc_update(rtc_t *rtc) {
+void rtc_set_clock(rtc_t *rtc, time_t base) {
+    rtc->emulated = 1;
+    rtc->base = base;
+}
+
+void rtc_update(rtc_t *rtc, uint64_t seconds) {
+    rtc->seconds = seconds;
     if (!(rtc->rtccr1 & (1 << RTCCR1_RUN_BIT))) {
         return;
     }
-    time_t t = time(NULL);
+    struct tm now;
     struct tm *old = &(rtc->time);
-    struct tm *new = localtime(&t);
+    struct tm *new = &now;
+    local_time(rtc, new);
     
     if (old->tm_sec != new->tm_sec) {
         rtc->pending_ints |= (1 << RTCFLG_1SEIFG_BIT);
@@ -108,8 +137,7 @@ void rtc_set_cr1(rtc_t *rtc, uint8_t byte) {
     );
     if (!(rtc->rtccr1 & (1 << RTCCR1_RUN_BIT))
         && (byte & (1 << RTCCR1_RUN_BIT))) {
-        time_t t = time(NULL);
-        rtc->time = *localtime(&t);
+        local_time(rtc, &rtc->time);
     }
     rtc->rtccr1 = byte & RTCCR1_MASK;
 }
@@ -92,11 +92,19 @@ typedef struct rtc {
 
     struct tm time;
     uint8_t pending_ints;
+
+    // follow emulated time from base instead of the host clock
+    int emulated;
+    time_t base;
+    uint64_t seconds; // as of the last update
 } rtc_t;
 
 void rtc_init(rtc_t *rtc);
 
-void rtc_update(rtc_t *rtc);
+void rtc_set_clock(rtc_t *rtc, time_t base);
+
+// seconds is the emulated time since reset
+void rtc_update(rtc_t *rtc, uint64_t seconds);
 
 int rtc_poll_int(rtc_t *rtc);
 
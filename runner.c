@@ -0,0 +1,475 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "powar.h"
+
+// Headless batch runner. Reads a job list and runs every job on a pool of
+// worker threads until its emulated duration has passed, then writes the
+// EEPROM and the last frame next to the given output prefix.
+//
+// Job list, one job per line, '#' starts a comment:
+//   <rom> <eeprom> <input script or -> <seconds> <output prefix>
+//
+// Input script, one event per line, times in emulated milliseconds:
+//   <ms> <keys>
+// where keys is any combination of l, e and r, or - for none.
+//
+// An input file ending in .pwm is a movie recorded by powar -r instead. The
+// job then replays it from reset on the emulated clock, and a duration of 0
+// runs it to its end.
+//
+// With -c, jobs start from the boot state cached in the given directory
+// instead of running the reset sequence, and times count from the end of
+// the boot.
+//
+// -J runs the ROM code translated to native code where the build supports
+// it, with the same results.
+
+#define QUANTUM_STATES (PW_STATES_PER_SECOND / 10)
+#define MAX_LINE 1024
+
+// boot state cache directory, NULL to always run the reset sequence
+static const char *boot_cache_dir = NULL;
+// run translated ROM code, see pw_set_jit
+static int use_jit = 0;
+
+typedef struct input_event {
+    uint64_t at;
+    uint8_t keys;
+} input_event_t;
+
+typedef struct job {
+    char *rom_path;
+    pw_rom_t *rom;
+    char *eeprom_path;
+    char *input_path;
+    char *out_prefix;
+    uint64_t duration;
+
+    input_event_t *inputs;
+    int num_inputs;
+    int next_input;
+    pw_movie_t *movie;
+
+    pw_context_t *ctx;
+    long steps;
+    int failed;
+} job_t;
+
+// Each worker owns a deque. The owner pushes and pops at the tail, idle
+// workers steal from the head.
+typedef struct deque {
+    pthread_mutex_t lock;
+    int *items;
+    int cap;
+    int head;
+    int size;
+} deque_t;
+
+typedef struct pool {
+    job_t *jobs;
+    int num_jobs;
+    deque_t *deques;
+    int num_workers;
+    int remaining;
+    pthread_mutex_t remaining_lock;
+} pool_t;
+
+typedef struct worker {
+    pool_t *pool;
+    int id;
+    unsigned seed;
+} worker_t;
+
+static void deque_init(deque_t *dq, int cap) {
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->items = calloc(cap, sizeof(int));
+    dq->cap = cap;
+    dq->head = 0;
+    dq->size = 0;
+}
+
+static void deque_push(deque_t *dq, int job) {
+    pthread_mutex_lock(&dq->lock);
+    dq->items[(dq->head + dq->size) % dq->cap] = job;
+    dq->size++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+static int deque_pop(deque_t *dq) {
+    int job = -1;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->size > 0) {
+        dq->size--;
+        job = dq->items[(dq->head + dq->size) % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+static int deque_steal(deque_t *dq) {
+    int job = -1;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->size > 0) {
+        job = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->size--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+static int load_file(const char *path, uint8_t *buf, size_t max, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 0;
+    }
+    *size = fread(buf, 1, max, f);
+    fclose(f);
+    return 1;
+}
+
+static int is_movie(const char *path) {
+    size_t len = strlen(path);
+    return len > 4 && strcmp(path + len - 4, ".pwm") == 0;
+}
+
+static int load_inputs(job_t *job) {
+    char line[MAX_LINE];
+    int cap = 16;
+
+    job->inputs = NULL;
+    job->num_inputs = 0;
+    job->next_input = 0;
+    if (strcmp(job->input_path, "-") == 0) {
+        return 1;
+    }
+
+    FILE *f = fopen(job->input_path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s\n", job->input_path);
+        return 0;
+    }
+    job->inputs = malloc(cap * sizeof(input_event_t));
+    while (fgets(line, sizeof(line), f)) {
+        double ms;
+        char keys[8];
+        if (line[0] == '#' || sscanf(line, "%lf %7s", &ms, keys) != 2) {
+            continue;
+        }
+        if (job->num_inputs == cap) {
+            cap *= 2;
+            job->inputs = realloc(job->inputs, cap * sizeof(input_event_t));
+        }
+        input_event_t *ev = &job->inputs[job->num_inputs++];
+        ev->at = (uint64_t)(ms * PW_STATES_PER_SECOND / 1000);
+        ev->keys = 0;
+        for (char *k = keys; *k; k++) {
+            switch (*k) {
+                case 'l': ev->keys |= PW_KEY_LEFT; break;
+                case 'e': ev->keys |= PW_KEY_ENTER; break;
+                case 'r': ev->keys |= PW_KEY_RIGHT; break;
+                default: break;
+            }
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+static int job_start(job_t *job) {
+    uint8_t *buf = malloc(PW_EEPROM_SIZE);
+    size_t size;
+    int ok = 0;
+
+    job->ctx = pw_create();
+    if (job->ctx == NULL || buf == NULL || job->rom == NULL) {
+        goto out;
+    }
+    pw_set_rom(job->ctx, job->rom);
+    pw_set_jit(job->ctx, use_jit);
+    if (!load_file(job->eeprom_path, buf, PW_EEPROM_SIZE, &size) || !pw_load_eeprom(job->ctx, buf, size)) {
+        goto out;
+    }
+    if (is_movie(job->input_path)) {
+        job->movie = pw_movie_play(job->input_path, job->ctx);
+        ok = job->movie != NULL;
+        if (ok && job->duration == 0) {
+            job->duration = UINT64_MAX;
+        }
+        goto out;
+    }
+    if (!load_inputs(job)) {
+        goto out;
+    }
+    if (boot_cache_dir != NULL) {
+        pw_boot(job->ctx, boot_cache_dir);
+        uint64_t base = pw_get_cycles(job->ctx);
+        job->duration += base;
+        for (int i = 0; i < job->num_inputs; i++) {
+            job->inputs[i].at += base;
+        }
+    } else {
+        pw_reset(job->ctx);
+    }
+    pw_set_keys(job->ctx, 0);
+    ok = 1;
+out:
+    free(buf);
+    return ok;
+}
+
+static void write_ppm(const char *path, const uint32_t *pixels) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", PW_SCREEN_WIDTH, PW_SCREEN_HEIGHT);
+    for (int i = 0; i < PW_SCREEN_WIDTH * PW_SCREEN_HEIGHT; i++) {
+        uint8_t rgb[3] = { pixels[i] >> 16, pixels[i] >> 8, pixels[i] };
+        fwrite(rgb, 1, 3, f);
+    }
+    fclose(f);
+}
+
+static void job_finish(job_t *job) {
+    char path[MAX_LINE + 16];
+
+    if (!job->failed) {
+        uint32_t pixels[PW_SCREEN_WIDTH * PW_SCREEN_HEIGHT];
+
+        snprintf(path, sizeof(path), "%s.eeprom.bin", job->out_prefix);
+        FILE *f = fopen(path, "wb");
+        if (f != NULL) {
+            fwrite(pw_get_eeprom(job->ctx), 1, PW_EEPROM_SIZE, f);
+            fclose(f);
+        } else {
+            fprintf(stderr, "Could not write %s\n", path);
+        }
+
+        pw_get_framebuffer(job->ctx, pixels, PW_SCREEN_WIDTH * sizeof(uint32_t));
+        snprintf(path, sizeof(path), "%s.ppm", job->out_prefix);
+        write_ppm(path, pixels);
+    }
+
+    if (job->movie != NULL) {
+        if (pw_movie_desynced(job->movie)) {
+            fprintf(stderr, "%s: replay went out of sync with the movie\n", job->out_prefix);
+        }
+        pw_movie_close(job->movie);
+        job->movie = NULL;
+    }
+    pw_destroy(job->ctx);
+    job->ctx = NULL;
+    free(job->inputs);
+    job->inputs = NULL;
+}
+
+// Runs one quantum, returns 1 when the job is done
+static int job_slice(job_t *job) {
+    if (job->ctx == NULL && !job_start(job)) {
+        job->failed = 1;
+        return 1;
+    }
+
+    uint64_t now = pw_get_cycles(job->ctx);
+    uint64_t end = now + QUANTUM_STATES;
+    if (end > job->duration) {
+        end = job->duration;
+    }
+    while (job->movie != NULL && now < end && !pw_halted(job->ctx) && !pw_movie_done(job->movie)) {
+        job->steps += pw_movie_run(job->movie, end - now);
+        now = pw_get_cycles(job->ctx);
+    }
+    while (job->movie == NULL && now < end && !pw_halted(job->ctx)) {
+        uint64_t until = end;
+        while (job->next_input < job->num_inputs && job->inputs[job->next_input].at <= now) {
+            pw_set_keys(job->ctx, job->inputs[job->next_input++].keys);
+        }
+        if (job->next_input < job->num_inputs && job->inputs[job->next_input].at < until) {
+            until = job->inputs[job->next_input].at;
+        }
+        job->steps += pw_run_states(job->ctx, until - now);
+        now = pw_get_cycles(job->ctx);
+    }
+    if (pw_halted(job->ctx)) {
+        fprintf(stderr, "%s: CPU halted\n", job->out_prefix);
+        job->failed = 1;
+        return 1;
+    }
+    if (job->movie != NULL && pw_movie_done(job->movie)) {
+        return 1;
+    }
+    return now >= job->duration;
+}
+
+static int find_job(worker_t *w) {
+    pool_t *pool = w->pool;
+    int job = deque_pop(&pool->deques[w->id]);
+    if (job != -1) {
+        return job;
+    }
+    // start at a random victim so thieves don't all hit the same deque
+    int start = rand_r(&w->seed) % pool->num_workers;
+    for (int i = 0; i < pool->num_workers; i++) {
+        int victim = (start + i) % pool->num_workers;
+        if (victim != w->id && (job = deque_steal(&pool->deques[victim])) != -1) {
+            return job;
+        }
+    }
+    return -1;
+}
+
+static int jobs_remaining(pool_t *pool, int finished) {
+    pthread_mutex_lock(&pool->remaining_lock);
+    pool->remaining -= finished;
+    int remaining = pool->remaining;
+    pthread_mutex_unlock(&pool->remaining_lock);
+    return remaining;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+
+    while (jobs_remaining(pool, 0) > 0) {
+        int idx = find_job(w);
+        if (idx == -1) {
+            // everything left is being run by someone else
+            usleep(1000);
+            continue;
+        }
+        job_t *job = &pool->jobs[idx];
+        if (job_slice(job)) {
+            job_finish(job);
+            printf("%s: %s, %ld steps\n", job->out_prefix, job->failed ? "failed" : "done", job->steps);
+            jobs_remaining(pool, 1);
+        } else {
+            // a started job goes back to the owner's end, so each worker
+            // keeps a single live instance and unstarted jobs get stolen
+            deque_push(&pool->deques[w->id], idx);
+        }
+    }
+    return NULL;
+}
+
+// All jobs using the same ROM file share one read-only copy of it
+static pw_rom_t *shared_rom(job_t *jobs, int num_jobs, const char *path) {
+    for (int i = 0; i < num_jobs; i++) {
+        if (strcmp(jobs[i].rom_path, path) == 0) {
+            return jobs[i].rom;
+        }
+    }
+    pw_rom_t *rom = pw_rom_open(path);
+    if (rom == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+    }
+    return rom;
+}
+
+static int parse_jobs(const char *path, job_t **jobs_out) {
+    char line[MAX_LINE];
+    char rom[MAX_LINE], eeprom[MAX_LINE], input[MAX_LINE], out[MAX_LINE];
+    double seconds;
+    int num_jobs = 0, cap = 16;
+    job_t *jobs;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    jobs = calloc(cap, sizeof(job_t));
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%1023s %1023s %1023s %lf %1023s", rom, eeprom, input, &seconds, out) != 5) {
+            continue;
+        }
+        if (num_jobs == cap) {
+            cap *= 2;
+            jobs = realloc(jobs, cap * sizeof(job_t));
+        }
+        job_t *job = &jobs[num_jobs];
+        memset(job, 0, sizeof(job_t));
+        job->rom = shared_rom(jobs, num_jobs, rom);
+        num_jobs++;
+        job->rom_path = strdup(rom);
+        job->eeprom_path = strdup(eeprom);
+        job->input_path = strdup(input);
+        job->out_prefix = strdup(out);
+        job->duration = (uint64_t)(seconds * PW_STATES_PER_SECOND);
+    }
+    fclose(f);
+    *jobs_out = jobs;
+    return num_jobs;
+}
+
+int main(int argc, char *argv[]) {
+    int num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:c:J")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_workers = atoi(optarg);
+                break;
+            case 'c':
+                boot_cache_dir = optarg;
+                break;
+            case 'J':
+                use_jit = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-j threads] [-c boot cache dir] [-J] jobs.txt\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-j threads] [-c boot cache dir] [-J] jobs.txt\n", argv[0]);
+        return 1;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    pool_t pool;
+    pool.num_jobs = parse_jobs(argv[optind], &pool.jobs);
+    if (pool.num_jobs < 0) {
+        return 1;
+    }
+    pool.num_workers = num_workers;
+    pool.remaining = pool.num_jobs;
+    pthread_mutex_init(&pool.remaining_lock, NULL);
+    pool.deques = calloc(num_workers, sizeof(deque_t));
+    for (int i = 0; i < num_workers; i++) {
+        deque_init(&pool.deques[i], pool.num_jobs + 1);
+    }
+    // deal the jobs out, in reverse so every worker starts with its first one
+    for (int i = pool.num_jobs - 1; i >= 0; i--) {
+        deque_push(&pool.deques[i % num_workers], i);
+    }
+
+    pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+    worker_t *workers = calloc(num_workers, sizeof(worker_t));
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < pool.num_jobs; i++) {
+        failed += pool.jobs[i].failed;
+    }
+    printf("%d jobs, %d failed\n", pool.num_jobs, failed);
+    return failed != 0;
+}
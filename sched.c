@@ -0,0 +1,93 @@
+#include <string.h>
+#include "sched.h"
+
+#define NOT_QUEUED 0xFF
+
+void sched_init(sched_t *s) {
+    memset(s, 0, sizeof(sched_t));
+    memset(s->pos, NOT_QUEUED, sizeof(s->pos));
+}
+
+static void swap(sched_t *s, int a, int b) {
+    uint8_t ea = s->heap[a];
+    uint8_t eb = s->heap[b];
+    s->heap[a] = eb;
+    s->heap[b] = ea;
+    s->pos[eb] = a;
+    s->pos[ea] = b;
+}
+
+static void sift_up(sched_t *s, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->when[s->heap[parent]] <= s->when[s->heap[i]]) {
+            break;
+        }
+        swap(s, i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(sched_t *s, int i) {
+    for (;;) {
+        int l = 2 * i + 1;
+        int r = l + 1;
+        int min = i;
+        if (l < s->size && s->when[s->heap[l]] < s->when[s->heap[min]]) {
+            min = l;
+        }
+        if (r < s->size && s->when[s->heap[r]] < s->when[s->heap[min]]) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        swap(s, i, min);
+        i = min;
+    }
+}
+
+void sched_set(sched_t *s, enum sched_event ev, uint64_t when) {
+    int i = s->pos[ev];
+    if (i == NOT_QUEUED) {
+        i = s->size++;
+        s->heap[i] = ev;
+        s->pos[ev] = i;
+        s->when[ev] = when;
+        sift_up(s, i);
+        return;
+    }
+    uint64_t old = s->when[ev];
+    s->when[ev] = when;
+    if (when < old) {
+        sift_up(s, i);
+    } else {
+        sift_down(s, i);
+    }
+}
+
+void sched_cancel(sched_t *s, enum sched_event ev) {
+    int i = s->pos[ev];
+    if (i == NOT_QUEUED) {
+        return;
+    }
+    s->pos[ev] = NOT_QUEUED;
+    s->size--;
+    if (i == s->size) {
+        return;
+    }
+    uint8_t moved = s->heap[s->size];
+    s->heap[i] = moved;
+    s->pos[moved] = i;
+    sift_up(s, i);
+    sift_down(s, s->pos[moved]);
+}
+
+int sched_pop(sched_t *s, uint64_t now) {
+    if (s->size == 0 || s->when[s->heap[0]] > now) {
+        return -1;
+    }
+    int ev = s->heap[0];
+    sched_cancel(s, ev);
+    return ev;
+}
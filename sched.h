@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+#define SCHED_NEVER UINT64_MAX
+
+// Every peripheral that needs to act at a point in emulated time gets one
+// slot here. At most one deadline is pending per slot.
+enum sched_event {
+    SCHED_TMRW,
+    SCHED_RTC,
+    SCHED_INPUT,
+    SCHED_IRQ,
+    NUM_SCHED_EVENTS,
+};
+
+// Binary min-heap of pending deadlines, in states since reset
+typedef struct sched {
+    uint64_t when[NUM_SCHED_EVENTS];
+    uint8_t heap[NUM_SCHED_EVENTS];
+    uint8_t pos[NUM_SCHED_EVENTS];
+    int size;
+} sched_t;
+
+void sched_init(sched_t *s);
+
+void sched_set(sched_t *s, enum sched_event ev, uint64_t when);
+void sched_cancel(sched_t *s, enum sched_event ev);
+
+// pops the earliest event due at or before now, or returns -1
+int sched_pop(sched_t *s, uint64_t now);
+
+static inline uint64_t sched_next(sched_t *s) {
+    return s->size ? s->when[s->heap[0]] : SCHED_NEVER;
+}